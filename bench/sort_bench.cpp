@@ -0,0 +1,64 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "dispatch.hpp"
+
+
+IIC_DISPATCH_KERNEL(void, sort_floats, (float*, std::size_t));
+
+// Sorts the same random floats with every version of iic::sort usable on this CPU and with std::sort
+// usage: sort_bench [count] [repetitions]
+int main(int argc, char** argv)
+{
+    const std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+    const int repetitions = argc > 2 ? std::atoi(argv[2]) : 5;
+
+    // Fixed seed so every run and every machine sorts the same input
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<float> distribution(-1e6f, 1e6f);
+    std::vector<float> input(count);
+    for(float& value : input)
+        value = distribution(generator);
+
+    std::vector<float> expected = input;
+    std::sort(expected.begin(), expected.end());
+
+    std::vector<float> work(count);
+    // Fastest of the repetitions, in milliseconds
+    auto measure = [&](const std::function<void(float*, std::size_t)>& sort)
+    {
+        double best = 0;
+        for(int repetition = 0; repetition < repetitions; ++repetition)
+        {
+            std::copy(input.begin(), input.end(), work.begin());
+            const auto start = std::chrono::steady_clock::now();
+            sort(work.data(), count);
+            const std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+            if(repetition == 0 || time.count() < best)
+                best = time.count();
+        }
+        if(work != expected)
+        {
+            std::cerr << "wrong result" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        return best;
+    };
+
+    std::cout << "sorting " << count << " floats, best of " << repetitions << " runs" << std::endl;
+    const double reference = measure([](float* data, std::size_t size) { std::sort(data, data + size); });
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::setw(12) << "std::sort" << std::setw(10) << reference << " ms" << std::endl;
+    for(const auto& implementation : sort_floats.available)
+    {
+        const double time = measure(implementation.function);
+        std::cout << std::setw(12) << iic::target_name(implementation.isa) << std::setw(10) << time << " ms"
+                  << std::setw(8) << std::setprecision(2) << reference / time << "x" << std::setprecision(1) << std::endl;
+    }
+}
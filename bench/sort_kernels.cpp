@@ -0,0 +1,9 @@
+#include "dispatch.hpp"
+#include "sort.hpp"
+
+
+// Compiled once per target, see iic_add_kernels in CMakeLists.txt
+IIC_KERNEL(void, sort_floats, (float* data, std::size_t size))
+{
+    iic::sort(data, size);
+}
@@ -0,0 +1,279 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef ALGORITHM_HPP
+#define ALGORITHM_HPP
+
+// Whole array kernels: the chunking, masked edges and threading of a foreach over spans
+// done once, so call sites only write the per element computation on varyings.
+
+#include "varying.hpp"
+#include "control_flow.hpp"
+#include "memory.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    // Runs a transform or for_each on several threads, each on a contiguous part of the arrays.
+    // 0 threads means std::thread::hardware_concurrency().
+    struct parallel_policy
+    {
+        unsigned threads = 0;
+    };
+
+    inline constexpr parallel_policy parallel{};
+
+    namespace detail
+    {
+        struct sequential_policy {};
+
+        // Fewest elements worth starting a thread for
+        constexpr std::size_t PARALLEL_GRAIN = 16 * 1024;
+
+        template<typename T>
+        using span_of = decltype(std::span(std::declval<T&>()));
+
+        template<typename T>
+        concept spannable = requires(T& array) { std::span(array); };
+
+        // Whether every argument but the last, the function, is an array
+        template<typename... Args>
+        constexpr bool arrays_then_function()
+        {
+            return []<std::size_t... I>(std::index_sequence<I...>)
+            {
+                return (spannable<std::tuple_element_t<I, std::tuple<Args...>>> && ...);
+            }(std::make_index_sequence<sizeof...(Args) - 1>{});
+        }
+
+        // Loads count consecutive elements into the first lanes, the others are default initialized.
+        // Whole chunks copy a constant number of elements so the copy is a vector load.
+        template<bool whole, typename T>
+        varying_impl<std::remove_cv_t<T>> load_chunk(const T* data, std::size_t count)
+        {
+            std::array<std::remove_cv_t<T>, LANE_SIZE> values{};
+            std::copy_n(data, whole ? LANE_SIZE : count, values.begin());
+            return varying_impl<std::remove_cv_t<T>>(Private{}, values);
+        }
+
+        template<bool whole, typename T>
+        void store_chunk(T* data, const varying_impl<T>& values, std::size_t count)
+        {
+            std::copy_n(values._values.begin(), whole ? LANE_SIZE : count, data);
+        }
+
+        // Only the arrays of mutable elements are written back by for_each
+        template<bool whole, typename T>
+        void write_back(T* data, const varying_impl<std::remove_cv_t<T>>& values, std::size_t count)
+        {
+            if constexpr(!std::is_const_v<T>)
+                store_chunk<whole>(data, values, count);
+        }
+
+        // Elements before the first one aligned like a whole vector, 0 if that takes more than a chunk
+        template<typename T>
+        std::size_t unaligned_head(const T* data)
+        {
+            constexpr std::size_t alignment = std::min<std::size_t>(chunk_alignment<T>, 64);
+            const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(data);
+            if(address % sizeof(T) != 0)
+                return 0;
+            const std::size_t head = (alignment - address % alignment) % alignment / sizeof(T);
+            return head < LANE_SIZE ? head : 0;
+        }
+
+        // Calls chunk(start, count, whole) for a masked head up to the first aligned element of anchor,
+        // then every whole chunk and finally a masked tail, with the mask set as in a foreach
+        template<typename T, typename F>
+        void for_each_chunk(const T* anchor, std::size_t size, F&& chunk)
+        {
+            restore_mask restore;
+            auto partial = [&](std::size_t start, std::size_t count)
+            {
+                for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                    _current_mask._values[i] = i < count;
+                chunk(start, count, std::false_type{});
+            };
+
+            std::size_t start = std::min(size, unaligned_head(anchor));
+            if(start != 0)
+                partial(0, start);
+            for(; start + LANE_SIZE <= size; start += LANE_SIZE)
+            {
+                _current_mask._values = all_true(std::make_index_sequence<LANE_SIZE>{});
+                chunk(start, LANE_SIZE, std::true_type{});
+            }
+            if(start < size)
+                partial(start, size - start);
+        }
+
+        template<typename F>
+        void run_pieces(sequential_policy, std::size_t size, F&& piece)
+        {
+            piece(std::size_t{0}, size);
+        }
+
+        // Cuts [0, size) in one piece per thread, rounded to whole cache lines of chunks
+        // so threads never write to the same line. The calling thread takes the first piece.
+        // The first exception thrown by a piece is rethrown once every thread is done.
+        template<typename F>
+        void run_pieces(parallel_policy policy, std::size_t size, F&& piece)
+        {
+            std::size_t threads = policy.threads != 0 ? policy.threads : std::thread::hardware_concurrency();
+            threads = std::max<std::size_t>(1, std::min(threads, size / PARALLEL_GRAIN));
+            if(threads == 1)
+            {
+                piece(std::size_t{0}, size);
+                return;
+            }
+
+            constexpr std::size_t granularity = LANE_SIZE * 64;
+            const std::size_t step = (size / threads + granularity - 1) / granularity * granularity;
+
+            std::exception_ptr error;
+            std::mutex error_mutex;
+            auto guarded = [&](std::size_t start, std::size_t count)
+            {
+                const trace_span task{ "piece", static_cast<std::int64_t>(start) };
+                try
+                {
+                    piece(start, count);
+                }
+                catch(...)
+                {
+                    const std::lock_guard lock(error_mutex);
+                    if(!error)
+                        error = std::current_exception();
+                }
+            };
+
+            {
+                std::vector<std::jthread> workers;
+                for(std::size_t start = step; start < size; start += step)
+                    workers.emplace_back(guarded, start, std::min(step, size - start));
+                guarded(0, std::min(step, size));
+            }
+            if(error)
+                std::rethrow_exception(error);
+        }
+
+        template<typename Policy, typename... Args>
+        void transform(Policy policy, Args&&... args)
+        {
+            constexpr std::size_t inputs = sizeof...(Args) - 2;
+            auto arguments = std::forward_as_tuple(args...);
+            auto&& f = std::get<inputs + 1>(arguments);
+            const auto output = std::span(std::get<inputs>(arguments));
+            using Output = typename decltype(output)::element_type;
+            static_assert(!std::is_const_v<Output>, "iic::transform needs a mutable output");
+
+            [&]<std::size_t... I>(std::index_sequence<I...>)
+            {
+                const std::tuple<span_of<std::tuple_element_t<I, std::tuple<Args...>>>...> spans{ std::get<I>(arguments)... };
+                assert(((std::get<I>(spans).size() >= output.size()) && ...));
+                run_pieces(policy, output.size(), [&](std::size_t begin, std::size_t size)
+                {
+                    for_each_chunk(output.data() + begin, size, [&]<bool whole>(std::size_t start, std::size_t count, std::bool_constant<whole>)
+                    {
+                        const std::size_t offset = begin + start;
+                        const varying_impl<Output> result(f(load_chunk<whole>(std::get<I>(spans).data() + offset, count)...));
+                        store_chunk<whole>(output.data() + offset, result, count);
+                    });
+                });
+            }(std::make_index_sequence<inputs>{});
+        }
+
+        template<typename Policy, typename... Args>
+        void for_each(Policy policy, Args&&... args)
+        {
+            constexpr std::size_t arrays = sizeof...(Args) - 1;
+            auto arguments = std::forward_as_tuple(args...);
+            auto&& f = std::get<arrays>(arguments);
+
+            [&]<std::size_t... I>(std::index_sequence<I...>)
+            {
+                const std::tuple<span_of<std::tuple_element_t<I, std::tuple<Args...>>>...> spans{ std::get<I>(arguments)... };
+                const auto& first = std::get<0>(spans);
+                assert(((std::get<I>(spans).size() >= first.size()) && ...));
+                run_pieces(policy, first.size(), [&](std::size_t begin, std::size_t size)
+                {
+                    for_each_chunk(first.data() + begin, size, [&]<bool whole>(std::size_t start, std::size_t count, std::bool_constant<whole>)
+                    {
+                        const std::size_t offset = begin + start;
+                        auto chunks = std::make_tuple(load_chunk<whole>(std::get<I>(spans).data() + offset, count)...);
+                        f(std::get<I>(chunks)...);
+                        (write_back<whole>(std::get<I>(spans).data() + offset, std::get<I>(chunks), count), ...);
+                    });
+                });
+            }(std::make_index_sequence<arrays>{});
+        }
+    }
+
+    // iic::transform(a, b, out, f) does out[i] = f(a[i], b[i]) for every element of out,
+    // with f taking and returning varyings. Arrays are anything std::span can be built from
+    // and the inputs must be at least as long as out.
+    // The elements before the first aligned chunk of out and after its last whole chunk
+    // are done with masked chunks, everything else with whole ones.
+    template<typename... Args>
+    requires (sizeof...(Args) >= 2 && detail::arrays_then_function<Args...>())
+    void transform(Args&&... args)
+    {
+        detail::transform(detail::sequential_policy{}, std::forward<Args>(args)...);
+    }
+
+    // iic::transform(iic::parallel, a, b, out, f) splits the work between threads,
+    // f is then called concurrently
+    template<typename... Args>
+    requires (sizeof...(Args) >= 2 && detail::arrays_then_function<Args...>())
+    void transform(parallel_policy policy, Args&&... args)
+    {
+        detail::transform(policy, std::forward<Args>(args)...);
+    }
+
+    // iic::for_each(a, b, f) calls f(a_chunk, b_chunk) with a varying& per array for every chunk
+    // of a, and writes back the chunks of the arrays with mutable elements
+    template<typename... Args>
+    requires (sizeof...(Args) >= 2 && detail::arrays_then_function<Args...>())
+    void for_each(Args&&... args)
+    {
+        detail::for_each(detail::sequential_policy{}, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    requires (sizeof...(Args) >= 2 && detail::arrays_then_function<Args...>())
+    void for_each(parallel_policy policy, Args&&... args)
+    {
+        detail::for_each(policy, std::forward<Args>(args)...);
+    }
+}
+
+#endif // ALGORITHM_HPP
@@ -0,0 +1,299 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef AUTOTUNE_HPP
+#define AUTOTUNE_HPP
+
+// Picks the fastest of several versions of a kernel by timing them, per input size.
+//
+// The lane width of a kernel is fixed when its translation unit is compiled, so the candidates
+// are whole functions: the versions of a dispatched kernel (one lane width per instruction set,
+// see dispatch.hpp) and any variant the caller makes, like other unroll factors or block sizes:
+//
+//     iic::autotuner<void(const float*, float*, int)> tuned("poly",
+//         iic::autotune_candidates(poly_unroll1, poly_unroll4),
+//         [](const float*, float*, int n) { return std::size_t(n); },
+//         [](std::size_t n, const auto& run) {
+//             std::vector<float> in(n, 1.f), out(n);
+//             run(in.data(), out.data(), int(n));
+//         });
+//     tuned(in, out, n);
+//
+// The first call for a size times every candidate, never on the arguments of the call: the last
+// function makes fresh arguments of the given size for every timed run, so kernels working in place,
+// accumulating or scattering into their output can be tuned too. The winners are kept per CPU model,
+// kernel and size (rounded to a power of 2) in a file, so later runs don't time again.
+// The file is $IIC_AUTOTUNE_CACHE, by default $XDG_CACHE_HOME/iic_autotune.tsv or ~/.cache/iic_autotune.tsv,
+// and nothing is saved if the variable is set but empty.
+
+#include "dispatch.hpp"
+
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+namespace iic
+{
+    namespace autotune_detail
+    {
+        inline std::string cpu_model()
+        {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+            unsigned registers[12];
+            if(__get_cpuid(0x80000002, &registers[0], &registers[1], &registers[2], &registers[3])
+               && __get_cpuid(0x80000003, &registers[4], &registers[5], &registers[6], &registers[7])
+               && __get_cpuid(0x80000004, &registers[8], &registers[9], &registers[10], &registers[11]))
+            {
+                std::string brand(reinterpret_cast<const char*>(registers), sizeof(registers));
+                brand = brand.substr(0, brand.find('\0'));
+                const std::size_t first = brand.find_first_not_of(' ');
+                if(first != std::string::npos)
+                    return brand.substr(first, brand.find_last_not_of(' ') - first + 1);
+            }
+#endif
+            return "unknown";
+        }
+
+        inline std::string autotune_cache_path()
+        {
+            if(const char* path = std::getenv("IIC_AUTOTUNE_CACHE"))
+                return path;
+            if(const char* cache = std::getenv("XDG_CACHE_HOME"); cache && *cache)
+                return std::string(cache) + "/iic_autotune.tsv";
+            if(const char* home = std::getenv("HOME"); home && *home)
+                return std::string(home) + "/.cache/iic_autotune.tsv";
+            return {};
+        }
+
+        // Winners of every kernel, saved as "cpu model \t kernel \t size bucket \t candidate" lines.
+        // Only the lines of this CPU model are used, the others are kept for the other machines
+        // sharing the file.
+        struct autotune_cache
+        {
+            std::mutex mutex;
+            std::string path = autotune_cache_path();
+            std::string cpu = cpu_model();
+            std::map<std::pair<std::string, unsigned>, std::string> winners;
+            bool loaded = false;
+
+            std::optional<std::string> find(const std::string& kernel, unsigned bucket)
+            {
+                const std::lock_guard lock(mutex);
+                load();
+                const auto found = winners.find({ kernel, bucket });
+                if(found == winners.end())
+                    return std::nullopt;
+                return found->second;
+            }
+
+            void store(const std::string& kernel, unsigned bucket, const std::string& candidate)
+            {
+                const std::lock_guard lock(mutex);
+                load();
+                winners[{ kernel, bucket }] = candidate;
+                if(path.empty())
+                    return;
+                // Appended so processes tuning at the same time don't lose each other's lines,
+                // the last line of a key wins when loading
+                std::ofstream file(path, std::ios::app);
+                file << cpu << '\t' << kernel << '\t' << bucket << '\t' << candidate << '\n';
+            }
+
+        private:
+            void load()
+            {
+                if(loaded)
+                    return;
+                loaded = true;
+                if(path.empty())
+                    return;
+                std::ifstream file(path);
+                std::string line;
+                while(std::getline(file, line))
+                {
+                    std::istringstream fields(line);
+                    std::string line_cpu, kernel, bucket, candidate;
+                    if(!std::getline(fields, line_cpu, '\t') || !std::getline(fields, kernel, '\t')
+                       || !std::getline(fields, bucket, '\t') || !std::getline(fields, candidate)
+                       || line_cpu != cpu)
+                        continue;
+                    // A line cut by a crash or edited by hand is skipped, it is only a cache
+                    unsigned bucket_value;
+                    const auto [end, error] = std::from_chars(bucket.data(), bucket.data() + bucket.size(), bucket_value);
+                    if(error == std::errc{} && end == bucket.data() + bucket.size())
+                        winners[{ kernel, bucket_value }] = candidate;
+                }
+            }
+        };
+
+        inline autotune_cache& global_autotune_cache()
+        {
+            static autotune_cache cache;
+            return cache;
+        }
+    }
+
+    template<typename Signature>
+    struct autotuner;
+
+    template<typename R, typename... Args>
+    struct autotuner<R(Args...)>
+    {
+        struct candidate
+        {
+            std::string name;
+            std::function<R(Args...)> function;
+        };
+
+        // Makes the arguments of a timed run of the given size and calls run with them,
+        // the arguments must stay valid until run returns
+        using input_function = std::function<void(std::size_t, const std::function<void(Args...)>& run)>;
+
+        // size gives the size of the problem from the arguments of a call, calls of similar sizes
+        // share their winner. input makes the arguments the candidates are timed on.
+        autotuner(std::string name, std::vector<candidate> candidates, std::function<std::size_t(Args...)> size, input_function input):
+            name(std::move(name)),
+            candidates(std::move(candidates)),
+            size(std::move(size)),
+            input(std::move(input))
+        {
+            if(this->candidates.empty())
+                throw std::invalid_argument("No candidate to autotune kernel " + this->name);
+        }
+
+        R operator()(Args... args)
+        {
+            return candidates[choose(args...)].function(std::forward<Args>(args)...);
+        }
+
+        // Times every candidate for this size and keeps the fastest, even if one was already chosen.
+        // For calibration runs before the kernel is used.
+        const candidate& calibrate(std::size_t problem_size)
+        {
+            const std::lock_guard lock(mutex);
+            return candidates[tune(problem_size)];
+        }
+
+        // Candidate used for calls of this size, null if not chosen yet
+        const candidate* selected(std::size_t problem_size) const
+        {
+            const std::lock_guard lock(mutex);
+            const auto found = choices.find(size_bucket(problem_size));
+            return found == choices.end() ? nullptr : &candidates[found->second];
+        }
+
+        std::string name;
+        std::vector<candidate> candidates;
+        std::function<std::size_t(Args...)> size;
+        input_function input;
+        // Runs of each candidate when timing, the fastest one counts
+        int repetitions = 3;
+
+    private:
+        static unsigned size_bucket(std::size_t problem_size)
+        {
+            return static_cast<unsigned>(std::bit_width(problem_size));
+        }
+
+        std::size_t choose(Args&... args)
+        {
+            const std::size_t problem_size = size(args...);
+            const unsigned bucket = size_bucket(problem_size);
+            const std::lock_guard lock(mutex);
+            if(const auto found = choices.find(bucket); found != choices.end())
+                return found->second;
+            if(const auto winner = autotune_detail::global_autotune_cache().find(name, bucket))
+            {
+                for(std::size_t i = 0; i < candidates.size(); ++i)
+                {
+                    if(candidates[i].name == *winner)
+                    {
+                        choices[bucket] = i;
+                        return i;
+                    }
+                }
+            }
+            return tune(problem_size);
+        }
+
+        std::size_t tune(std::size_t problem_size)
+        {
+            const unsigned bucket = size_bucket(problem_size);
+            std::size_t best = 0;
+            double best_time = std::numeric_limits<double>::infinity();
+            for(std::size_t i = 0; i < candidates.size(); ++i)
+            {
+                for(int repetition = 0; repetition < repetitions; ++repetition)
+                {
+                    // Fresh arguments for every run, only the call of the candidate is timed
+                    input(problem_size, [&](Args... args)
+                    {
+                        const auto start = std::chrono::steady_clock::now();
+                        candidates[i].function(std::forward<Args>(args)...);
+                        const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+                        if(time.count() < best_time)
+                        {
+                            best_time = time.count();
+                            best = i;
+                        }
+                    });
+                }
+            }
+            choices[bucket] = best;
+            autotune_detail::global_autotune_cache().store(name, bucket, candidates[best].name);
+            return best;
+        }
+
+        mutable std::mutex mutex;
+        std::map<unsigned, std::size_t> choices;
+    };
+
+    // Every version of the dispatched kernels usable on this CPU, named "kernel/target"
+    template<typename R, typename... Args, typename... Others>
+    std::vector<typename autotuner<R(Args...)>::candidate>
+    autotune_candidates(const dispatcher<R(Args...)>& kernel, const Others&... others)
+    {
+        std::vector<typename autotuner<R(Args...)>::candidate> result;
+        for(const dispatcher<R(Args...)>* d : { &kernel, &others... })
+            for(const auto& implementation : d->available)
+                result.push_back({ std::string(d->name) + "/" + std::string(target_name(implementation.isa)), implementation.function });
+        return result;
+    }
+}
+
+#endif // AUTOTUNE_HPP
@@ -24,8 +24,12 @@
 #define CONTROL_FLOW_HPP
 
 #include "varying.hpp"
+#include "memory.hpp"
+#include "trace.hpp"
 
-namespace iic
+#include <algorithm>
+
+namespace iic::inline IIC_TARGET_NAMESPACE
 {
     namespace detail
     {
@@ -40,7 +44,7 @@ namespace iic
             bool condition;
         };
         
-        std::array<bool, LANE_SIZE> internal_and(const std::array<bool, LANE_SIZE>& a, const std::array<bool, LANE_SIZE>& b)
+        inline std::array<bool, LANE_SIZE> internal_and(const std::array<bool, LANE_SIZE>& a, const std::array<bool, LANE_SIZE>& b)
         {
             auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
             {
@@ -61,6 +65,7 @@ namespace iic
                 old_mask(Private{}, _current_mask._values)
             {
                 _current_mask._values = compute_mask();
+                trace_divergence(old_mask._values, _current_mask._values);
             }
             
             std::array<bool, LANE_SIZE> compute_mask()
@@ -123,13 +128,31 @@ namespace iic
         
         struct unmasked_state : restore_mask
         {
+            [[no_unique_address]] trace_span span;
+
             unmasked_state():
-                restore_mask()
+                unmasked_state("unmasked")
+            {}
+
+            // Named after the construct, for the trace
+            explicit unmasked_state(const char* name):
+                restore_mask(),
+                span{ name }
             {
                 _current_mask._values = all_true(std::make_index_sequence<LANE_SIZE>{});
             }
         };
         
+        // Scratch arrays taken during a foreach are given back when it ends
+        struct foreach_state : unmasked_state
+        {
+            scratch_scope scratch;
+
+            foreach_state():
+                unmasked_state("foreach")
+            {}
+        };
+        
         template<bool is_varying>
         struct while_state;
         
@@ -222,6 +245,188 @@ namespace iic
                 return iterator(*this, iterator::end_marker{});
             }
         };
+        
+        struct foreach_unique_tag {};
+        
+        template<typename T>
+        requires std::equality_comparable<T>
+        struct foreach_unique_state : restore_mask
+        {
+            std::array<T, LANE_SIZE> values;
+            // Active lanes whose value has not been visited yet
+            std::array<bool, LANE_SIZE> remaining;
+            
+            foreach_unique_state(const varying_impl<T>& v):
+                restore_mask(),
+                values{v._values},
+                remaining{old_mask._values}
+            {}
+            
+            struct iterator
+            {
+                foreach_unique_state& state;
+                std::array<bool, LANE_SIZE> current{};
+                
+                bool operator!=(const iterator& other) const
+                {
+                    return std::any_of(state.remaining.begin(), state.remaining.end(), [](bool b){ return b; });
+                }
+                
+                // Runs the body with only the lanes holding the value of the first remaining lane
+                T operator*()
+                {
+                    const std::size_t lane = std::find(state.remaining.begin(), state.remaining.end(), true) - state.remaining.begin();
+                    const T value = state.values[lane];
+                    auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+                    {
+                        return std::array<bool, LANE_SIZE> {
+                            (state.remaining[I] && state.values[I] == value)...
+                        };
+                    };
+                    current = helper(std::make_index_sequence<LANE_SIZE>{});
+                    _current_mask._values = current;
+                    return value;
+                }
+                
+                iterator& operator++()
+                {
+                    auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+                    {
+                        ((state.remaining[I] = state.remaining[I] && !current[I]), ...);
+                    };
+                    helper(std::make_index_sequence<LANE_SIZE>{});
+                    return *this;
+                }
+            };
+            
+            iterator begin()
+            {
+                return iterator{*this};
+            }
+            
+            iterator end()
+            {
+                return iterator{*this};
+            }
+        };
+        
+        // Lets iic_foreach_unique(value : expression) turn the expression into the loop state
+        template<typename T>
+        foreach_unique_state<T> operator,(const varying_impl<T>& v, foreach_unique_tag)
+        {
+            return foreach_unique_state<T>(v);
+        }
+        
+        template<typename T>
+        foreach_unique_state<std::remove_cv_t<T>> operator,(const varying_reference<T>& v, foreach_unique_tag)
+        {
+            return foreach_unique_state<std::remove_cv_t<T>>(v);
+        }
+    }
+
+    namespace detail
+    {
+        // K consecutive chunks of a range, what the body of an unrolled foreach gets
+        template<typename T, std::size_t K>
+        struct unrolled_chunks
+        {
+            T start, finish;
+
+            // Calls f(index, std::integral_constant<std::size_t, k>{}) for every chunk k of the block
+            // that has elements, with the mask of that chunk. The calls are made one after the other:
+            // for a whole block the mask is set once and nothing runs between them, so once they are
+            // inlined the compiler can schedule them together, but they only form independent
+            // dependency chains if f keeps its state per k (e.g. one accumulator each).
+            // Only the chunks of the tail block set their own mask.
+            template<typename F>
+            void each(F&& f) const
+            {
+                restore_mask restore;
+                auto helper = [&]<std::size_t... k>(std::index_sequence<k...>)
+                {
+                    if(finish - start >= static_cast<T>(K * LANE_SIZE))
+                    {
+                        // Whole block, every lane of every chunk is active
+                        _current_mask._values = all_true(std::make_index_sequence<LANE_SIZE>{});
+                        (f(whole_chunk(k), std::integral_constant<std::size_t, k>{}), ...);
+                    }
+                    else
+                        (partial_chunk(f, std::integral_constant<std::size_t, k>{}), ...);
+                };
+                helper(std::make_index_sequence<K>{});
+            }
+
+        private:
+            varying_impl<T> whole_chunk(std::size_t k) const
+            {
+                std::array<T, LANE_SIZE> values;
+                for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                    values[i] = start + static_cast<T>(k * LANE_SIZE + i);
+                return varying_impl<T>(Private{}, values);
+            }
+
+            // Chunks of the tail block: whole ones, then one masked chunk, then nothing
+            template<typename F, std::size_t k>
+            void partial_chunk(F& f, std::integral_constant<std::size_t, k> chunk) const
+            {
+                if(finish - start <= static_cast<T>(k * LANE_SIZE))
+                    return;
+                std::array<bool, LANE_SIZE> mask{};
+                std::array<T, LANE_SIZE> values{};
+                for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                {
+                    mask[i] = static_cast<T>(k * LANE_SIZE + i) < finish - start;
+                    if(mask[i])
+                        values[i] = start + static_cast<T>(k * LANE_SIZE + i);
+                }
+                _current_mask._values = mask;
+                f(varying_impl<T>(Private{}, values), chunk);
+            }
+        };
+
+        template<typename T, std::size_t K>
+        struct unrolled_range
+        {
+            T start, finish;
+
+            struct iterator
+            {
+                T current;
+                T finish;
+
+                bool operator!=(const iterator& other)
+                {
+                    return current != other.current;
+                }
+
+                // Outside of each(), the body runs with the mask of the first chunk
+                unrolled_chunks<T, K> operator*()
+                {
+                    const T remaining = finish - current;
+                    const T block = remaining < static_cast<T>(K * LANE_SIZE) ? remaining : static_cast<T>(K * LANE_SIZE);
+                    for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                        _current_mask._values[i] = static_cast<T>(i) < block;
+                    const unrolled_chunks<T, K> chunks{ current, current + block };
+                    current += block;
+                    return chunks;
+                }
+
+                iterator& operator++()
+                {
+                    return *this;
+                }
+            };
+
+            iterator begin()
+            {
+                return iterator{start, finish};
+            }
+
+            iterator end()
+            {
+                return iterator{finish, finish};
+            }
+        };
     }
 
     template<typename T>
@@ -235,6 +440,7 @@ namespace iic
         {
             T current;
             T finish;
+            [[no_unique_address]] detail::trace_chunk chunk{};
 
             bool operator!=(const iterator& other)
             {
@@ -243,6 +449,7 @@ namespace iic
 
             detail::varying_impl<T> operator*()
             {
+                chunk.begin(detail::trace_value(current));
                 std::array<bool, detail::LANE_SIZE> new_mask{};
                 std::array<T, detail::LANE_SIZE> new_values{};
                 for(int i = 0; i < detail::LANE_SIZE && current != finish; ++current, ++i)
@@ -268,7 +475,127 @@ namespace iic
         {
             return iterator{finish, finish};
         }
+
+        // iic_foreach(block : iic::range(0, n).unroll<4>()) hands 4 chunks to the body at once,
+        // block.each(f) runs f on each of them. Only the last chunk of the range is masked.
+        template<std::size_t K>
+        requires (K > 0)
+        detail::unrolled_range<T, K> unroll() const
+        {
+            return { start, finish };
+        }
     };
+    
+    namespace detail
+    {
+        struct foreach_persistent_tag {};
+        
+        template<typename T>
+        struct persistent_state
+        {
+            T next, finish;
+            // Item each lane is working on, if any
+            std::array<T, LANE_SIZE> items{};
+            std::array<bool, LANE_SIZE> live{};
+            // Lanes that got their item in the current iteration
+            std::array<bool, LANE_SIZE> fresh{};
+            
+            // Gives a new item to every idle lane, returns whether there is work left
+            bool refill()
+            {
+                for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                {
+                    fresh[i] = !live[i] && next != finish;
+                    if(fresh[i])
+                    {
+                        items[i] = next;
+                        ++next;
+                        live[i] = true;
+                    }
+                }
+                _current_mask._values = live;
+                return std::any_of(live.begin(), live.end(), [](bool b){ return b; });
+            }
+        };
+        
+        // What the body of iic_foreach_persistent gets, acts on the active lanes
+        template<typename T>
+        struct persistent_lanes
+        {
+            persistent_state<T>* state;
+            
+            // Item of each lane
+            varying_impl<T> index() const
+            {
+                return varying_impl<T>(Private{}, state->items);
+            }
+            
+            // Lanes that just started working on their item, to initialize their state
+            mask_t fresh() const
+            {
+                return mask_t(Private{}, internal_and(state->fresh, _current_mask._values));
+            }
+            
+            // The active lanes are done with their item, they get a new one at the next iteration
+            void retire()
+            {
+                for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                    if(_current_mask._values[i])
+                        state->live[i] = false;
+            }
+            
+            // Same but first gives the items of the active lanes to a completion callback
+            template<typename F>
+            void retire(F&& on_retire)
+            {
+                on_retire(index());
+                retire();
+            }
+        };
+        
+        template<typename T>
+        struct persistent_range
+        {
+            persistent_state<T> state;
+            
+            struct iterator
+            {
+                persistent_state<T>& state;
+                
+                bool operator!=(const iterator& other)
+                {
+                    return state.refill();
+                }
+                
+                persistent_lanes<T> operator*()
+                {
+                    return { &state };
+                }
+                
+                iterator& operator++()
+                {
+                    return *this;
+                }
+            };
+            
+            iterator begin()
+            {
+                return iterator{state};
+            }
+            
+            iterator end()
+            {
+                return iterator{state};
+            }
+        };
+        
+        // Lets iic_foreach_persistent(job : range) turn the range into the loop state
+        template<typename T>
+        persistent_range<T> operator,(const range<T>& r, foreach_persistent_tag)
+        {
+            return persistent_range<T>{ persistent_state<T>{ r.start, r.finish } };
+        }
+    }
 }
 
 
@@ -339,11 +666,34 @@ else                 \
                     CAT(body, __LINE__):
 
 
+#define iic_internal_foreach_scope \
+if(0)                \
+    CAT(finished, __LINE__): ; \
+else                 \
+    for(::iic::detail::foreach_state CAT(state, __LINE__) ;;) \
+        if(1)        \
+            goto CAT(body, __LINE__);           \
+        else \
+            while(1) \
+                if(1)\
+                    goto CAT(finished, __LINE__); \
+                else \
+                    CAT(body, __LINE__):
+
+
 #define iic_foreach(decl) \
-iic_unmasked \
+iic_internal_foreach_scope \
     for(auto decl)
             
     
+// Keeps every lane busy: the lanes that retire their item get the next one of the range
+// while the others are still working, instead of waiting for the slowest lane of the chunk.
+// The body runs once per step, with the lanes that have an item active.
+#define iic_foreach_persistent(decl) \
+iic_internal_foreach_scope \
+    for(auto decl, ::iic::detail::foreach_persistent_tag{})
+            
+    
 #define iic_while(cond) \
 if(0)                   \
     CAT(finished, __LINE__): ; \
@@ -362,6 +712,10 @@ else                    \
 
 #define iic_foreach_active(variable) \
 for(auto variable : ::iic::detail::foreach_active_state{})
+
+
+#define iic_foreach_unique(decl) \
+for(auto decl, ::iic::detail::foreach_unique_tag{})
         
                
         
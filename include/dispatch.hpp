@@ -0,0 +1,206 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef DISPATCH_HPP
+#define DISPATCH_HPP
+
+// Runtime selection between versions of a kernel compiled for several instruction sets.
+//
+// The kernel is written once, in a source file compiled once per target with IIC_TARGET,
+// IIC_LANE_SIZE and the matching -m flags (the iic_add_kernels CMake function does that):
+//
+//     IIC_KERNEL(void, sum, (const float* a, const float* b, float* c, int n))
+//     {
+//         iic_foreach(i : iic::range(0, n)) ...
+//     }
+//
+// and the code calling it declares it with
+//
+//     IIC_DISPATCH_KERNEL(void, sum, (const float*, const float*, float*, int));
+//
+// which defines a `sum` callable running the best version supported by the CPU.
+// Parameters can use plain types and the storage types of the library (float16_t, bfloat16_t,
+// aligned_buffer), but not the types that change with the target like varying, range or histogram:
+// the version of such a kernel would not be found, so the dispatcher throws when it sees one.
+// The inline functions a kernel source shares with the rest of the program, like the
+// standard algorithms, are compiled with the instructions of its target: on ELF platforms
+// iic_add_kernels makes them local to the objects of the target so the linker can't pick
+// them for the generic code. Elsewhere a source compiled for a target should only contain kernels.
+
+#include "varying.hpp"
+
+#include <cstdlib>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace iic
+{
+    // Instruction sets a kernel can be compiled for, from the least to the most capable
+    enum class target
+    {
+        generic,
+        sse4,
+        avx2,
+        avx512
+    };
+
+    inline std::string_view target_name(target t)
+    {
+        switch(t)
+        {
+            case target::generic: return "generic";
+            case target::sse4: return "sse4";
+            case target::avx2: return "avx2";
+            case target::avx512: return "avx512";
+        }
+        return "unknown";
+    }
+
+    inline bool is_supported(target t)
+    {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        __builtin_cpu_init();
+        switch(t)
+        {
+            case target::generic:
+                return true;
+            case target::sse4:
+                return __builtin_cpu_supports("sse4.2");
+            case target::avx2:
+                return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+                       && __builtin_cpu_supports("f16c");
+            case target::avx512:
+                return is_supported(target::avx2) && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd")
+                       && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")
+                       && __builtin_cpu_supports("avx512dq");
+        }
+        return false;
+#else
+        return t == target::generic;
+#endif
+    }
+
+    // Most capable target usable on this machine, can be lowered with the
+    // IIC_MAX_TARGET environment variable (generic, sse4, avx2 or avx512)
+    inline target best_supported_target()
+    {
+        target limit = target::avx512;
+        if(const char* env = std::getenv("IIC_MAX_TARGET"))
+        {
+            for(target t : { target::generic, target::sse4, target::avx2, target::avx512 })
+                if(target_name(t) == env)
+                    limit = t;
+        }
+
+        target best = target::generic;
+        for(target t : { target::sse4, target::avx2, target::avx512 })
+            if(t <= limit && is_supported(t))
+                best = t;
+        return best;
+    }
+
+    template<typename Signature>
+    struct dispatcher;
+
+    template<typename R, typename... Args>
+    struct dispatcher<R(Args...)>
+    {
+        using function_type = R(*)(Args...);
+
+        struct implementation
+        {
+            target isa;
+            function_type function;
+            // Whether IIC_KERNEL defined this version, with any signature
+            bool compiled = false;
+        };
+
+        // Null functions are versions that were not compiled in and are ignored
+        dispatcher(std::string_view name, std::initializer_list<implementation> implementations):
+            name(name)
+        {
+            const target best = best_supported_target();
+            for(const implementation& impl : implementations)
+            {
+                // Types of the library that change with the target (varying, range, histogram...) give
+                // a version a different mangled name than the one the caller declared
+                if(impl.compiled && !impl.function)
+                    throw std::logic_error("Kernel " + std::string(name) + " was compiled for " + std::string(target_name(impl.isa))
+                                           + " with another signature, its parameters can't use types that depend on the target");
+                if(!impl.function || impl.isa > best)
+                    continue;
+                available.push_back(impl);
+                if(!selected.function || impl.isa > selected.isa)
+                    selected = impl;
+            }
+        }
+
+        R operator()(Args... args) const
+        {
+            if(!selected.function)
+                throw std::runtime_error("No version of kernel " + std::string(name) + " usable on this CPU");
+            return selected.function(std::forward<Args>(args)...);
+        }
+
+        target selected_target() const
+        {
+            return selected.isa;
+        }
+
+        std::string_view name;
+        // Every version that can run on this CPU
+        std::vector<implementation> available;
+        implementation selected{ target::generic, nullptr };
+    };
+}
+
+#define IIC_KERNEL_NAME(name, isa) IIC_INTERNAL_CAT(name, IIC_INTERNAL_CAT(_iic_, isa))
+// Unmangled symbol telling a version was compiled, even when its signature doesn't match the caller's
+#define IIC_KERNEL_MARKER(name, isa) IIC_INTERNAL_CAT(iic_kernel_, IIC_KERNEL_NAME(name, isa))
+
+// Defines the version of a kernel for the target the translation unit is compiled for
+#define IIC_KERNEL(return_type, name, parameters) \
+extern "C" const char IIC_KERNEL_MARKER(name, IIC_TARGET) = 1; \
+return_type IIC_KERNEL_NAME(name, IIC_TARGET) parameters
+
+// Versions of the kernel are weak so the ones that were not built are null
+#define IIC_DISPATCH_KERNEL(return_type, name, parameters) \
+__attribute__((weak)) return_type IIC_KERNEL_NAME(name, generic) parameters; \
+__attribute__((weak)) return_type IIC_KERNEL_NAME(name, sse4) parameters; \
+__attribute__((weak)) return_type IIC_KERNEL_NAME(name, avx2) parameters; \
+__attribute__((weak)) return_type IIC_KERNEL_NAME(name, avx512) parameters; \
+extern "C" __attribute__((weak)) const char IIC_KERNEL_MARKER(name, generic); \
+extern "C" __attribute__((weak)) const char IIC_KERNEL_MARKER(name, sse4); \
+extern "C" __attribute__((weak)) const char IIC_KERNEL_MARKER(name, avx2); \
+extern "C" __attribute__((weak)) const char IIC_KERNEL_MARKER(name, avx512); \
+inline const ::iic::dispatcher<return_type parameters> name(#name, { \
+    { ::iic::target::generic, &IIC_KERNEL_NAME(name, generic), &IIC_KERNEL_MARKER(name, generic) != nullptr }, \
+    { ::iic::target::sse4, &IIC_KERNEL_NAME(name, sse4), &IIC_KERNEL_MARKER(name, sse4) != nullptr }, \
+    { ::iic::target::avx2, &IIC_KERNEL_NAME(name, avx2), &IIC_KERNEL_MARKER(name, avx2) != nullptr }, \
+    { ::iic::target::avx512, &IIC_KERNEL_NAME(name, avx512), &IIC_KERNEL_MARKER(name, avx512) != nullptr } \
+})
+
+#endif // DISPATCH_HPP
@@ -0,0 +1,294 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef FLOAT16_HPP
+#define FLOAT16_HPP
+
+#include "varying.hpp"
+
+#include <bit>
+#include <cstdint>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// The storage types are the same for every target, so kernels compiled for several targets
+// can take them in their signature (see dispatch.hpp)
+namespace iic
+{
+    namespace float16_detail
+    {
+        // Round to nearest even, see https://gist.github.com/rygorous/2156668
+        // Kept free of F16C, the same code has to work for every target
+        inline std::uint16_t float_to_half_bits(float value)
+        {
+            constexpr std::uint32_t f32_infinity = 255u << 23;
+            constexpr std::uint32_t f16_max = (127u + 16u) << 23;
+            constexpr std::uint32_t denorm_magic_bits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+            std::uint32_t bits = std::bit_cast<std::uint32_t>(value);
+            const std::uint32_t sign = bits & 0x80000000u;
+            bits ^= sign;
+
+            std::uint16_t result;
+            if(bits >= f16_max)
+                result = bits > f32_infinity ? 0x7e00 : 0x7c00;
+            else if(bits < (113u << 23))
+            {
+                const float denormal = std::bit_cast<float>(bits) + std::bit_cast<float>(denorm_magic_bits);
+                result = static_cast<std::uint16_t>(std::bit_cast<std::uint32_t>(denormal) - denorm_magic_bits);
+            }
+            else
+            {
+                const std::uint32_t mantissa_odd = (bits >> 13) & 1u;
+                bits += ((15u - 127u) << 23) + 0xfffu;
+                bits += mantissa_odd;
+                result = static_cast<std::uint16_t>(bits >> 13);
+            }
+            return result | static_cast<std::uint16_t>(sign >> 16);
+        }
+
+        inline float half_bits_to_float(std::uint16_t bits)
+        {
+            constexpr std::uint32_t shifted_exponent = 0x7c00u << 13;
+            constexpr std::uint32_t denorm_magic_bits = 113u << 23;
+
+            std::uint32_t result = (bits & 0x7fffu) << 13;
+            const std::uint32_t exponent = result & shifted_exponent;
+            result += (127u - 15u) << 23;
+
+            if(exponent == shifted_exponent) // Inf and NaN
+                result += (128u - 16u) << 23;
+            else if(exponent == 0) // Zero and denormals
+            {
+                result += 1u << 23;
+                result = std::bit_cast<std::uint32_t>(std::bit_cast<float>(result) - std::bit_cast<float>(denorm_magic_bits));
+            }
+
+            result |= (bits & 0x8000u) << 16;
+            return std::bit_cast<float>(result);
+        }
+
+        inline std::uint16_t float_to_bfloat16_bits(float value)
+        {
+            const std::uint32_t bits = std::bit_cast<std::uint32_t>(value);
+            if((bits & 0x7fffffffu) > 0x7f800000u) // Keep NaN quiet instead of rounding it to Inf
+                return static_cast<std::uint16_t>((bits >> 16) | 0x40u);
+            return static_cast<std::uint16_t>((bits + 0x7fffu + ((bits >> 16) & 1u)) >> 16);
+        }
+
+        inline float bfloat16_bits_to_float(std::uint16_t bits)
+        {
+            return std::bit_cast<float>(static_cast<std::uint32_t>(bits) << 16);
+        }
+    }
+
+    // IEEE 754 half precision storage type.
+    // There is no arithmetic on it, values are widened to float for every operation
+    // so only loads and stores are done on 16 bits.
+    struct float16_t
+    {
+        std::uint16_t bits = 0;
+
+        float16_t() = default;
+        float16_t(float value): bits(float16_detail::float_to_half_bits(value)) {}
+
+        operator float() const
+        {
+            return float16_detail::half_bits_to_float(bits);
+        }
+    };
+
+    // Brain floating point storage type, the upper half of a float
+    struct bfloat16_t
+    {
+        std::uint16_t bits = 0;
+
+        bfloat16_t() = default;
+        bfloat16_t(float value): bits(float16_detail::float_to_bfloat16_bits(value)) {}
+
+        operator float() const
+        {
+            return float16_detail::bfloat16_bits_to_float(bits);
+        }
+    };
+
+    static_assert(sizeof(float16_t) == 2 && sizeof(bfloat16_t) == 2);
+}
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    namespace detail
+    {
+        template<>
+        struct is_lane_storage<float16_t> : std::true_type {};
+
+        template<>
+        struct is_lane_storage<bfloat16_t> : std::true_type {};
+
+        template<>
+        struct lane_converter<float, float16_t>
+        {
+            static std::array<float, LANE_SIZE> convert(const std::array<float16_t, LANE_SIZE>& values)
+            {
+                std::array<float, LANE_SIZE> result;
+                std::size_t i = 0;
+#if defined(__F16C__)
+                // vcvtph2ps handles 4 lanes at a time
+                for(; i + 4 <= LANE_SIZE; i += 4)
+                    _mm_storeu_ps(&result[i], _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&values[i]))));
+#endif
+                for(; i < LANE_SIZE; ++i)
+                    result[i] = values[i];
+                return result;
+            }
+        };
+
+        template<>
+        struct lane_converter<float16_t, float>
+        {
+            static std::array<float16_t, LANE_SIZE> convert(const std::array<float, LANE_SIZE>& values)
+            {
+                std::array<float16_t, LANE_SIZE> result;
+                std::size_t i = 0;
+#if defined(__F16C__)
+                for(; i + 4 <= LANE_SIZE; i += 4)
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(&result[i]),
+                                     _mm_cvtps_ph(_mm_loadu_ps(&values[i]), _MM_FROUND_TO_NEAREST_INT));
+#endif
+                for(; i < LANE_SIZE; ++i)
+                    result[i] = values[i];
+                return result;
+            }
+        };
+
+        template<>
+        struct lane_converter<float, bfloat16_t>
+        {
+            static std::array<float, LANE_SIZE> convert(const std::array<bfloat16_t, LANE_SIZE>& values)
+            {
+                auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+                {
+                    return std::array<float, LANE_SIZE>{
+                        float16_detail::bfloat16_bits_to_float(values[I].bits)...
+                    };
+                };
+                return helper(std::make_index_sequence<LANE_SIZE>{});
+            }
+        };
+
+        template<>
+        struct lane_converter<bfloat16_t, float>
+        {
+            static std::array<bfloat16_t, LANE_SIZE> convert(const std::array<float, LANE_SIZE>& values)
+            {
+                auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+                {
+                    return std::array<bfloat16_t, LANE_SIZE>{
+                        bfloat16_t(values[I])...
+                    };
+                };
+                return helper(std::make_index_sequence<LANE_SIZE>{});
+            }
+        };
+
+        // Every other arithmetic type goes through float
+        template<typename T>
+        requires (!std::same_as<T, float>)
+        struct lane_converter<T, float16_t>
+        {
+            static std::array<T, LANE_SIZE> convert(const std::array<float16_t, LANE_SIZE>& values)
+            {
+                return lane_converter<T, float>::convert(lane_converter<float, float16_t>::convert(values));
+            }
+        };
+
+        template<typename U>
+        requires (!std::same_as<U, float>)
+        struct lane_converter<float16_t, U>
+        {
+            static std::array<float16_t, LANE_SIZE> convert(const std::array<U, LANE_SIZE>& values)
+            {
+                return lane_converter<float16_t, float>::convert(lane_converter<float, U>::convert(values));
+            }
+        };
+
+        template<typename T>
+        requires (!std::same_as<T, float>)
+        struct lane_converter<T, bfloat16_t>
+        {
+            static std::array<T, LANE_SIZE> convert(const std::array<bfloat16_t, LANE_SIZE>& values)
+            {
+                return lane_converter<T, float>::convert(lane_converter<float, bfloat16_t>::convert(values));
+            }
+        };
+
+        template<typename U>
+        requires (!std::same_as<U, float>)
+        struct lane_converter<bfloat16_t, U>
+        {
+            static std::array<bfloat16_t, LANE_SIZE> convert(const std::array<U, LANE_SIZE>& values)
+            {
+                return lane_converter<bfloat16_t, float>::convert(lane_converter<float, U>::convert(values));
+            }
+        };
+
+        template<>
+        struct lane_converter<float16_t, float16_t>
+        {
+            static std::array<float16_t, LANE_SIZE> convert(const std::array<float16_t, LANE_SIZE>& values)
+            {
+                return values;
+            }
+        };
+
+        template<>
+        struct lane_converter<bfloat16_t, bfloat16_t>
+        {
+            static std::array<bfloat16_t, LANE_SIZE> convert(const std::array<bfloat16_t, LANE_SIZE>& values)
+            {
+                return values;
+            }
+        };
+
+        template<>
+        struct lane_converter<float16_t, bfloat16_t>
+        {
+            static std::array<float16_t, LANE_SIZE> convert(const std::array<bfloat16_t, LANE_SIZE>& values)
+            {
+                return lane_converter<float16_t, float>::convert(lane_converter<float, bfloat16_t>::convert(values));
+            }
+        };
+
+        template<>
+        struct lane_converter<bfloat16_t, float16_t>
+        {
+            static std::array<bfloat16_t, LANE_SIZE> convert(const std::array<float16_t, LANE_SIZE>& values)
+            {
+                return lane_converter<bfloat16_t, float>::convert(lane_converter<float, float16_t>::convert(values));
+            }
+        };
+    }
+}
+
+#endif // FLOAT16_HPP
@@ -0,0 +1,103 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef INSTANTIATIONS_HPP
+#define INSTANTIATIONS_HPP
+
+// Explicit instantiations of varying and of its operators for the common lane types.
+//
+// With IIC_EXTERN_TEMPLATES defined, varying.hpp includes this header and every translation unit
+// only declares them, they are compiled once in src/instantiations.cpp (one object per target,
+// see the IIC_EXTERN_TEMPLATES CMake option) instead of in every file using them.
+// The declared functions are then no longer inlined, which slows optimized builds down without
+// making them compile faster (inline functions are still instantiated to be inlined), so it is
+// meant for debug builds.
+
+#include "varying.hpp"
+
+#ifdef IIC_INSTANTIATE_TEMPLATES
+#define IIC_INTERNAL_INSTANTIATION template
+#else
+#define IIC_INTERNAL_INSTANTIATION extern template
+#endif
+
+#define IIC_INTERNAL_INSTANTIATE_OP(T, OP) \
+    IIC_INTERNAL_INSTANTIATION varying_impl<decltype(std::declval<T>() OP std::declval<T>())> \
+        operator OP <T, T>(const varying_impl<T>&, const varying_impl<T>&); \
+    IIC_INTERNAL_INSTANTIATION varying_impl<decltype(std::declval<T>() OP std::declval<T>())> \
+        operator OP <T, T>(const varying_impl<T>&, const T&); \
+    IIC_INTERNAL_INSTANTIATION varying_impl<decltype(std::declval<T>() OP std::declval<T>())> \
+        operator OP <T, T>(const T&, const varying_impl<T>&);
+
+#define IIC_INTERNAL_INSTANTIATE_COMPARISONS(T) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, ==) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, !=) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, <) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, >) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, <=) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, >=)
+
+#define IIC_INTERNAL_INSTANTIATE_ARITHMETIC(T) \
+    IIC_INTERNAL_INSTANTIATION struct varying_impl<T>; \
+    IIC_INTERNAL_INSTANTIATE_OP(T, +) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, -) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, *) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, /) \
+    IIC_INTERNAL_INSTANTIATE_COMPARISONS(T)
+
+#define IIC_INTERNAL_INSTANTIATE_INTEGER(T) \
+    IIC_INTERNAL_INSTANTIATE_ARITHMETIC(T) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, %) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, &) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, |) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, ^) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, <<) \
+    IIC_INTERNAL_INSTANTIATE_OP(T, >>)
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    namespace detail
+    {
+        // Not the whole class, bool has no ++ and --. The copies can't be named apart from
+        // the converting templates, so they are left to the files using them.
+        IIC_INTERNAL_INSTANTIATION varying_impl<bool>::varying_impl();
+        IIC_INTERNAL_INSTANTIATION varying_impl<bool>::varying_impl(varying_impl&&);
+        IIC_INTERNAL_INSTANTIATION varying_impl<bool>& varying_impl<bool>::operator=(varying_impl&&);
+        IIC_INTERNAL_INSTANTIATE_OP(bool, &&)
+        IIC_INTERNAL_INSTANTIATE_OP(bool, ||)
+        IIC_INTERNAL_INSTANTIATE_OP(bool, ==)
+        IIC_INTERNAL_INSTANTIATE_OP(bool, !=)
+
+        IIC_INTERNAL_INSTANTIATE_INTEGER(int)
+        IIC_INTERNAL_INSTANTIATE_INTEGER(unsigned)
+        IIC_INTERNAL_INSTANTIATE_ARITHMETIC(float)
+        IIC_INTERNAL_INSTANTIATE_ARITHMETIC(double)
+    }
+}
+
+#undef IIC_INTERNAL_INSTANTIATE_INTEGER
+#undef IIC_INTERNAL_INSTANTIATE_ARITHMETIC
+#undef IIC_INTERNAL_INSTANTIATE_COMPARISONS
+#undef IIC_INTERNAL_INSTANTIATE_OP
+#undef IIC_INTERNAL_INSTANTIATION
+
+#endif // INSTANTIATIONS_HPP
@@ -0,0 +1,245 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef MAPPED_RANGE_HPP
+#define MAPPED_RANGE_HPP
+
+#include "varying.hpp"
+#include "control_flow.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    // Advice given to the kernel about how a mapped file will be accessed
+    enum map_hint : unsigned
+    {
+        no_hint = 0,
+        sequential = 1 << 0, // Aggressive read-ahead, pages behind are dropped early
+        will_need = 1 << 1, // Start reading the whole mapping right away
+        huge_pages = 1 << 2 // Back the mapping with transparent huge pages when the file system allows it
+    };
+
+    namespace detail
+    {
+        [[noreturn]] inline void throw_system_error(const std::string& what)
+        {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+
+        struct file_descriptor
+        {
+            int fd = -1;
+
+            explicit file_descriptor(const std::string& path):
+                fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC))
+            {
+                if(fd < 0)
+                    throw_system_error("Can't open " + path);
+            }
+
+            file_descriptor(file_descriptor&& other) noexcept:
+                fd(std::exchange(other.fd, -1))
+            {}
+
+            file_descriptor& operator=(file_descriptor&& other) noexcept
+            {
+                std::swap(fd, other.fd);
+                return *this;
+            }
+
+            ~file_descriptor()
+            {
+                if(fd >= 0)
+                    ::close(fd);
+            }
+
+            std::size_t size() const
+            {
+                struct stat info;
+                if(::fstat(fd, &info) != 0)
+                    throw_system_error("Can't stat file");
+                return static_cast<std::size_t>(info.st_size);
+            }
+        };
+    }
+
+    // Read only view of a binary file of T records, mapped in memory instead of read.
+    // Iterating over it gives the varying index of the records, to be used with data():
+    //     iic::mapped_range<float> values("values.bin");
+    //     iic_foreach(i : values)
+    //         total += *(values.data() + i);
+    template<typename T>
+    requires std::is_trivially_copyable_v<T>
+    struct mapped_range
+    {
+        explicit mapped_range(const std::string& path, unsigned hints = sequential):
+            mapped_range(detail::file_descriptor(path), hints)
+        {}
+
+        // Maps only the records in [first, first + count) of an already opened file
+        mapped_range(const detail::file_descriptor& file, std::size_t first, std::size_t count, unsigned hints = sequential)
+        {
+            map(file.fd, first, count, hints);
+        }
+
+        mapped_range(mapped_range&& other) noexcept:
+            _mapping(std::exchange(other._mapping, nullptr)),
+            _mapping_size(std::exchange(other._mapping_size, 0)),
+            _data(std::exchange(other._data, nullptr)),
+            _size(std::exchange(other._size, 0))
+        {}
+
+        mapped_range& operator=(mapped_range&& other) noexcept
+        {
+            std::swap(_mapping, other._mapping);
+            std::swap(_mapping_size, other._mapping_size);
+            std::swap(_data, other._data);
+            std::swap(_size, other._size);
+            return *this;
+        }
+
+        ~mapped_range()
+        {
+            if(_mapping)
+                ::munmap(_mapping, _mapping_size);
+        }
+
+        const T* data() const { return _data; }
+        std::size_t size() const { return _size; }
+
+        typename range<std::size_t>::iterator begin() const
+        {
+            return range<std::size_t>(0, _size).begin();
+        }
+
+        typename range<std::size_t>::iterator end() const
+        {
+            return range<std::size_t>(0, _size).end();
+        }
+
+    private:
+        mapped_range(const detail::file_descriptor& file, unsigned hints):
+            mapped_range(file, 0, file.size() / sizeof(T), hints)
+        {}
+
+        void map(int fd, std::size_t first, std::size_t count, unsigned hints)
+        {
+            if(count == 0)
+                return;
+
+            // The offset of a mapping must be a multiple of the page size
+            const std::size_t page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+            const std::size_t offset = first * sizeof(T);
+            const std::size_t page_offset = offset % page_size;
+            _mapping_size = page_offset + count * sizeof(T);
+
+            void* mapping = ::mmap(nullptr, _mapping_size, PROT_READ, MAP_PRIVATE, fd,
+                                   static_cast<off_t>(offset - page_offset));
+            if(mapping == MAP_FAILED)
+                detail::throw_system_error("Can't map file");
+            _mapping = mapping;
+            _data = reinterpret_cast<const T*>(static_cast<const char*>(mapping) + page_offset);
+            _size = count;
+
+            // Advice is only a hint, failures are not an error
+            if(hints & sequential)
+                ::madvise(_mapping, _mapping_size, MADV_SEQUENTIAL);
+            if(hints & will_need)
+                ::madvise(_mapping, _mapping_size, MADV_WILLNEED);
+#if defined(MADV_HUGEPAGE)
+            if(hints & huge_pages)
+                ::madvise(_mapping, _mapping_size, MADV_HUGEPAGE);
+#endif
+        }
+
+        void* _mapping = nullptr;
+        std::size_t _mapping_size = 0;
+        const T* _data = nullptr;
+        std::size_t _size = 0;
+    };
+
+    // Maps a file a window of records at a time, to go over files bigger than the
+    // address space that can be spent on them. Only one window is mapped at any time:
+    //     for(auto window : iic::mapped_chunks<float>("values.bin", 1 << 24))
+    //         iic_foreach(i : window) ...
+    template<typename T>
+    requires std::is_trivially_copyable_v<T>
+    struct mapped_chunks
+    {
+        mapped_chunks(const std::string& path, std::size_t records_per_chunk, unsigned hints = sequential):
+            file(path),
+            records(file.size() / sizeof(T)),
+            records_per_chunk(std::max<std::size_t>(records_per_chunk, 1)),
+            hints(hints)
+        {}
+
+        detail::file_descriptor file;
+        std::size_t records;
+        std::size_t records_per_chunk;
+        unsigned hints;
+
+        struct iterator
+        {
+            const mapped_chunks& chunks;
+            std::size_t first;
+
+            bool operator!=(const iterator& other) const
+            {
+                return first != other.first;
+            }
+
+            mapped_range<T> operator*() const
+            {
+                return mapped_range<T>(chunks.file, first, std::min(chunks.records_per_chunk, chunks.records - first), chunks.hints);
+            }
+
+            iterator& operator++()
+            {
+                first += std::min(chunks.records_per_chunk, chunks.records - first);
+                return *this;
+            }
+        };
+
+        iterator begin() const
+        {
+            return iterator{*this, 0};
+        }
+
+        iterator end() const
+        {
+            return iterator{*this, records};
+        }
+    };
+}
+
+#endif // MAPPED_RANGE_HPP
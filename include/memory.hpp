@@ -0,0 +1,336 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include "varying.hpp"
+#include "varying_ptr.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <span>
+#include <vector>
+
+namespace iic
+{
+    namespace storage_detail
+    {
+        // Lanes of the widest target (64 one byte lanes with avx512) and size of its registers.
+        // Buffers are aligned and padded for it so that the same buffer type works for every target.
+        constexpr std::size_t MAX_LANE_SIZE = 64;
+        constexpr std::size_t MAX_VECTOR_BYTES = 64;
+
+        inline std::size_t round_up_to_all_lanes(std::size_t size)
+        {
+            return (size + MAX_LANE_SIZE - 1) / MAX_LANE_SIZE * MAX_LANE_SIZE;
+        }
+
+        struct aligned_deleter
+        {
+            std::size_t alignment;
+
+            void operator()(void* pointer) const
+            {
+                ::operator delete(pointer, std::align_val_t{alignment});
+            }
+        };
+    }
+
+    // Array whose storage is aligned on a whole vector register and padded to a multiple
+    // of the programCount of every target, so every chunk can be accessed with full vector
+    // loads and stores. The padding is value-initialized and can be freely read and written.
+    // It is the same type for every target, so kernels can take it as a parameter (see dispatch.hpp).
+    template<typename T>
+    requires std::default_initializable<T>
+             && std::copyable<T>
+    struct aligned_buffer
+    {
+        static constexpr std::size_t alignment = std::max(alignof(T), storage_detail::MAX_VECTOR_BYTES);
+
+        explicit aligned_buffer(std::size_t size):
+            _data(allocate(storage_detail::round_up_to_all_lanes(size)), storage_detail::aligned_deleter{alignment}),
+            _size(size)
+        {
+            std::uninitialized_value_construct_n(_data.get(), padded_size());
+        }
+
+        aligned_buffer(std::size_t size, const T& value):
+            aligned_buffer(size)
+        {
+            std::fill_n(_data.get(), size, value);
+        }
+
+        aligned_buffer(const aligned_buffer& other):
+            _data(allocate(other.padded_size()), storage_detail::aligned_deleter{alignment}),
+            _size(other._size)
+        {
+            std::uninitialized_copy_n(other._data.get(), padded_size(), _data.get());
+        }
+
+        aligned_buffer(aligned_buffer&& other) noexcept = default;
+
+        aligned_buffer& operator=(const aligned_buffer& other)
+        {
+            if(this != &other)
+                *this = aligned_buffer(other);
+            return *this;
+        }
+
+        aligned_buffer& operator=(aligned_buffer&& other) noexcept
+        {
+            if(this == &other)
+                return *this;
+            destroy();
+            _data = std::move(other._data);
+            _size = other._size;
+            return *this;
+        }
+
+        ~aligned_buffer()
+        {
+            destroy();
+        }
+
+        T* data() { return _data.get(); }
+        const T* data() const { return _data.get(); }
+        std::size_t size() const { return _size; }
+        std::size_t padded_size() const { return storage_detail::round_up_to_all_lanes(_size); }
+
+        T& operator[](std::size_t index) { return _data.get()[index]; }
+        const T& operator[](std::size_t index) const { return _data.get()[index]; }
+
+        T* begin() { return data(); }
+        T* end() { return data() + _size; }
+        const T* begin() const { return data(); }
+        const T* end() const { return data() + _size; }
+
+        // Loads the chunk that starts at the first lane of index.
+        // index must be the consecutive index of a foreach over a range starting at a multiple
+        // of programCount. Every lane is read, including the inactive ones.
+        // The lanes come from the target of index, found by argument dependent lookup.
+        template<typename Index>
+        auto load(const Index& index) const
+        {
+            return aligned_buffer_load(*this, index);
+        }
+
+        // Stores in the chunk that starts at the first lane of index, only active lanes are written
+        template<typename Index, typename Value>
+        void store(const Index& index, const Value& value)
+        {
+            aligned_buffer_store(*this, index, value);
+        }
+
+    private:
+        static T* allocate(std::size_t count)
+        {
+            return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t{alignment}));
+        }
+
+        void destroy()
+        {
+            if(_data)
+                std::destroy_n(_data.get(), padded_size());
+        }
+
+        std::unique_ptr<T, storage_detail::aligned_deleter> _data;
+        std::size_t _size;
+    };
+}
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    namespace detail
+    {
+        static_assert(storage_detail::MAX_LANE_SIZE % LANE_SIZE == 0, "aligned_buffer padding must hold whole chunks");
+
+        // Alignment of a whole chunk of lanes, so a chunk never straddles two vector loads
+        template<typename T>
+        constexpr std::size_t chunk_alignment = std::max(alignof(T), std::bit_ceil(LANE_SIZE * sizeof(T)));
+
+        inline std::size_t round_up_to_lanes(std::size_t size)
+        {
+            return (size + LANE_SIZE - 1) / LANE_SIZE * LANE_SIZE;
+        }
+
+        using storage_detail::aligned_deleter;
+
+        // Bump allocator, only freed in bulk by going back to a previous mark
+        struct scratch_arena
+        {
+            static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+            struct block
+            {
+                std::unique_ptr<std::byte, aligned_deleter> memory;
+                std::size_t size;
+            };
+
+            struct marker
+            {
+                std::size_t block;
+                std::size_t offset;
+            };
+
+            std::vector<block> blocks;
+            std::size_t current_block = 0;
+            std::size_t offset = 0;
+
+            marker mark() const
+            {
+                return { current_block, offset };
+            }
+
+            // Every allocation made since the mark is invalidated, memory is kept for later use
+            void release(marker m)
+            {
+                current_block = m.block;
+                offset = m.offset;
+            }
+
+            void* allocate(std::size_t bytes, std::size_t alignment)
+            {
+                while(current_block < blocks.size())
+                {
+                    std::byte* memory = blocks[current_block].memory.get();
+                    const auto address = reinterpret_cast<std::uintptr_t>(memory) + offset;
+                    const std::size_t start = offset + (alignment - address % alignment) % alignment;
+                    if(start + bytes <= blocks[current_block].size)
+                    {
+                        offset = start + bytes;
+                        return memory + start;
+                    }
+                    ++current_block;
+                    offset = 0;
+                }
+
+                std::size_t size = std::max(BLOCK_SIZE, bytes);
+                std::size_t block_alignment = std::max(alignment, alignof(std::max_align_t));
+                blocks.push_back({
+                    std::unique_ptr<std::byte, aligned_deleter>(
+                        static_cast<std::byte*>(::operator new(size, std::align_val_t{block_alignment})),
+                        aligned_deleter{block_alignment}),
+                    size
+                });
+                current_block = blocks.size() - 1;
+                offset = bytes;
+                return blocks.back().memory.get();
+            }
+        };
+
+        inline scratch_arena& thread_scratch_arena()
+        {
+            thread_local scratch_arena arena;
+            return arena;
+        }
+
+        template<typename T, typename I>
+        T* aligned_buffer_chunk(T* data, std::size_t padded_size, const varying_impl<I>& index)
+        {
+            // Chunks start at multiples of programCount, so they are aligned on the power of 2 dividing a chunk size
+            constexpr std::size_t chunk_bytes = LANE_SIZE * sizeof(T);
+            constexpr std::size_t alignment = std::min(aligned_buffer<std::remove_cv_t<T>>::alignment, chunk_bytes & (~chunk_bytes + 1));
+            const auto start = static_cast<std::size_t>(index._values[0]);
+            assert(start % LANE_SIZE == 0 && start < padded_size);
+            return std::assume_aligned<alignment>(data + start);
+        }
+
+        template<typename T, typename I>
+        varying_impl<T> aligned_buffer_load(const aligned_buffer<T>& buffer, const varying_impl<I>& index)
+        {
+            varying_impl<T> result;
+            const T* chunk = aligned_buffer_chunk(buffer.data(), buffer.padded_size(), index);
+            std::copy_n(chunk, LANE_SIZE, result._values.begin());
+            return result;
+        }
+
+        template<typename T, typename I, typename U>
+        requires std::convertible_to<U, T>
+        void aligned_buffer_store(aligned_buffer<T>& buffer, const varying_impl<I>& index, const varying_impl<U>& value)
+        {
+            T* chunk = aligned_buffer_chunk(buffer.data(), buffer.padded_size(), index);
+            const varying_impl<T> converted(value);
+            if(std::ranges::all_of(_current_mask._values, std::identity{}))
+            {
+                std::copy_n(converted._values.begin(), LANE_SIZE, chunk);
+                return;
+            }
+            // The inactive lanes are not written at all, another thread may own them
+#if defined(__AVX2__)
+            if constexpr(has_native_gather<T>)
+            {
+                for(std::size_t i = 0; i < LANE_SIZE; i += 4)
+                    _mm_maskstore_epi32(reinterpret_cast<int*>(chunk + i), mask_vector(i),
+                                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(&converted._values[i])));
+                return;
+            }
+#endif
+            for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                if(_current_mask._values[i])
+                    chunk[i] = converted._values[i];
+        }
+    }
+
+    // Gives back the scratch arrays taken on this thread during its lifetime.
+    // Every iic_foreach has one, code taking scratch arrays outside of a foreach needs its own
+    // or the arena of the thread grows with every call.
+    struct scratch_scope
+    {
+        scratch_scope():
+            mark(detail::thread_scratch_arena().mark())
+        {}
+
+        ~scratch_scope()
+        {
+            detail::thread_scratch_arena().release(mark);
+        }
+
+        scratch_scope(const scratch_scope&) = delete;
+        scratch_scope& operator=(const scratch_scope&) = delete;
+
+    private:
+        detail::scratch_arena::marker mark;
+    };
+
+    // Kernel-local scratch array taken from a per thread arena, aligned and padded like
+    // an aligned_buffer and value-initialized. It is given back when the innermost
+    // scratch_scope ends (iic_foreach has one), so it must not be used past that point.
+    template<typename T>
+    requires std::default_initializable<T>
+             && std::is_trivially_destructible_v<T>
+    std::span<T> scratch(std::size_t size)
+    {
+        const std::size_t padded = detail::round_up_to_lanes(size);
+        void* memory = detail::thread_scratch_arena().allocate(padded * sizeof(T), detail::chunk_alignment<T>);
+        T* data = static_cast<T*>(memory);
+        std::uninitialized_value_construct_n(data, padded);
+        return { data, size };
+    }
+}
+
+#endif // MEMORY_HPP
@@ -0,0 +1,430 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef RANDOM_HPP
+#define RANDOM_HPP
+
+// Random number generators producing one value per lane at once.
+// Each lane has its own stream, and streams of different tasks (threads, work items...)
+// built with the same seed don't overlap, so results don't depend on how work is split.
+
+#include "varying.hpp"
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <numbers>
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    namespace random
+    {
+        namespace detail
+        {
+            using iic::detail::varying_impl;
+            using iic::detail::LANE_SIZE;
+            using iic::detail::Private;
+            using iic::detail::select_with_mask;
+
+            // The generators work on plain arrays with loops over every lane so that compilers
+            // vectorize them, the mask is only applied to the results and the stored state
+            using lanes_u32 = std::array<std::uint32_t, LANE_SIZE>;
+            using lanes_float = std::array<float, LANE_SIZE>;
+
+            inline std::uint64_t splitmix64(std::uint64_t& state)
+            {
+                std::uint64_t z = (state += 0x9e3779b97f4a7c15u);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+                return z ^ (z >> 31);
+            }
+
+            constexpr std::uint32_t rotate_left(std::uint32_t x, int k)
+            {
+                return (x << k) | (x >> (32 - k));
+            }
+
+            // Jumping a linear generator by n values is a combination of the states it goes through,
+            // given by the polynomial x^n modulo the characteristic polynomial of the generator.
+            // 128 bits polynomials, lowest coefficient first.
+            using polynomial = std::array<std::uint32_t, 4>;
+
+            // Characteristic polynomial of xoshiro128 without its x^128 term
+            constexpr polynomial xoshiro128_characteristic{ 0xde18fc01u, 0x1b489db6u, 0x006254b1u, 0x00fc65a2u };
+
+            constexpr polynomial xoshiro128_multiply(polynomial a, const polynomial& b)
+            {
+                polynomial result{};
+                for(std::uint32_t word : b)
+                {
+                    for(int bit = 0; bit < 32; ++bit)
+                    {
+                        if(word & (1u << bit))
+                            for(std::size_t i = 0; i < 4; ++i)
+                                result[i] ^= a[i];
+                        // a * x, reduced when the x^128 term appears
+                        const bool reduce = a[3] >> 31;
+                        for(std::size_t i = 3; i > 0; --i)
+                            a[i] = (a[i] << 1) | (a[i - 1] >> 31);
+                        a[0] <<= 1;
+                        if(reduce)
+                            for(std::size_t i = 0; i < 4; ++i)
+                                a[i] ^= xoshiro128_characteristic[i];
+                    }
+                }
+                return result;
+            }
+
+            // Polynomial of a jump repeated exponent times, in O(log(exponent))
+            constexpr polynomial xoshiro128_power(polynomial jump, std::uint64_t exponent)
+            {
+                polynomial result{ 1, 0, 0, 0 };
+                for(; exponent != 0; exponent >>= 1)
+                {
+                    if(exponent & 1)
+                        result = xoshiro128_multiply(result, jump);
+                    jump = xoshiro128_multiply(jump, jump);
+                }
+                return result;
+            }
+
+            // Uniform float in [0, 1) from the 24 high bits
+            inline float to_unit_float(std::uint32_t bits)
+            {
+                return static_cast<float>(bits >> 8) * (1.0f / 16777216.0f);
+            }
+
+            // Natural logarithm of a normal positive float, with the polynomial of the Cephes library.
+            // Written without calls nor branches so a loop over lanes is vectorized.
+            inline float log_positive(float x)
+            {
+                const std::uint32_t bits = std::bit_cast<std::uint32_t>(x);
+                float exponent = static_cast<float>(static_cast<int>(bits >> 23) - 127);
+                float mantissa = std::bit_cast<float>((bits & 0x7fffffu) | 0x3f800000u);
+                const bool above_sqrt2 = mantissa > std::numbers::sqrt2_v<float>;
+                mantissa = above_sqrt2 ? mantissa * 0.5f : mantissa;
+                exponent = above_sqrt2 ? exponent + 1.0f : exponent;
+
+                const float f = mantissa - 1.0f;
+                const float f2 = f * f;
+                float p = 7.0376836292e-2f;
+                p = p * f - 1.1514610310e-1f;
+                p = p * f + 1.1676998740e-1f;
+                p = p * f - 1.2420140846e-1f;
+                p = p * f + 1.4249322787e-1f;
+                p = p * f - 1.6668057665e-1f;
+                p = p * f + 2.0000714765e-1f;
+                p = p * f - 2.4999993993e-1f;
+                p = p * f + 3.3333331174e-1f;
+                const float y = p * f * f2 - 2.12194440e-4f * exponent - 0.5f * f2;
+                return f + y + 0.693359375f * exponent;
+            }
+
+            // Square root of a non negative float. std::sqrt may set errno so it keeps loops scalar,
+            // this one is an estimate of the inverse square root refined by Newton iterations.
+            inline float sqrt_non_negative(float x)
+            {
+                float inverse = std::bit_cast<float>(0x5f375a86u - (std::bit_cast<std::uint32_t>(x) >> 1));
+                inverse = inverse * (1.5f - 0.5f * x * inverse * inverse);
+                inverse = inverse * (1.5f - 0.5f * x * inverse * inverse);
+                inverse = inverse * (1.5f - 0.5f * x * inverse * inverse);
+                return x * inverse;
+            }
+
+            // Cosine and sine of 2 pi turns for turns in [0, 1).
+            // turns is split in a quarter turn and a remainder in [-1/8, 1/8] without rounding error.
+            inline void sincos_turns(float turns, float& sine, float& cosine)
+            {
+                const int quadrant = static_cast<int>(turns * 4.0f + 0.5f);
+                const float x = (turns - static_cast<float>(quadrant) * 0.25f) * (2.0f * std::numbers::pi_v<float>);
+                const float x2 = x * x;
+                const float s = x + x * x2 * (-1.6666654611e-1f + x2 * (8.3321608736e-3f + x2 * -1.9515295891e-4f));
+                const float c = 1.0f - 0.5f * x2 + x2 * x2 * (4.166664568298827e-2f + x2 * (-1.388731625493765e-3f + x2 * 2.443315711809948e-5f));
+                const int q = quadrant & 3;
+                sine = q == 0 ? s : q == 1 ? c : q == 2 ? -s : -c;
+                cosine = q == 0 ? c : q == 1 ? -s : q == 2 ? -c : s;
+            }
+
+            // Uniform and normal samples for any generator with a next_lanes() giving 32 random bits per lane
+            template<typename Generator>
+            struct distributions
+            {
+                // 32 random bits per lane
+                varying_impl<std::uint32_t> next()
+                {
+                    return varying_impl<std::uint32_t>(Private{}, select_with_mask(self().next_lanes()));
+                }
+
+                // Uniform float in [0, 1)
+                varying_impl<float> uniform()
+                {
+                    const lanes_u32 bits = self().next_lanes();
+                    lanes_float result;
+                    for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                        result[i] = to_unit_float(bits[i]);
+                    return varying_impl<float>(Private{}, select_with_mask(result));
+                }
+
+                // Uniform float in [low, high)
+                varying_impl<float> uniform(float low, float high)
+                {
+                    return uniform() * (high - low) + low;
+                }
+
+                // Normally distributed float of mean 0 and standard deviation 1.
+                // The Box-Muller transform gives two samples, the second one is returned by the next call.
+                varying_impl<float> normal()
+                {
+                    if(_has_spare_normal)
+                    {
+                        _has_spare_normal = false;
+                        return varying_impl<float>(Private{}, select_with_mask(_spare_normal));
+                    }
+
+                    const lanes_u32 bits1 = self().next_lanes();
+                    const lanes_u32 bits2 = self().next_lanes();
+                    lanes_float result;
+                    for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                    {
+                        // 1 - u1 is in (0, 1] so the logarithm is finite
+                        const float radius = sqrt_non_negative(-2.0f * log_positive(1.0f - to_unit_float(bits1[i])));
+                        float sine, cosine;
+                        sincos_turns(to_unit_float(bits2[i]), sine, cosine);
+                        result[i] = radius * cosine;
+                        _spare_normal[i] = radius * sine;
+                    }
+                    _has_spare_normal = true;
+                    return varying_impl<float>(Private{}, select_with_mask(result));
+                }
+
+                varying_impl<float> normal(float mean, float deviation)
+                {
+                    return normal() * deviation + mean;
+                }
+
+            private:
+                Generator& self()
+                {
+                    return static_cast<Generator&>(*this);
+                }
+
+                lanes_float _spare_normal;
+                bool _has_spare_normal = false;
+            };
+        }
+
+        // Philox 4x32-10 from "Parallel random numbers: as easy as 1, 2, 3" (Salmon et al.).
+        // A value is a hash of a counter (block, lane, task) by the key (seed), so there is no
+        // state to carry per lane and jumping anywhere in a stream is free.
+        // Every call advances all the lanes, whatever the mask.
+        struct philox : detail::distributions<philox>
+        {
+            explicit philox(std::uint64_t seed, std::uint32_t task = 0):
+                _key{ static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32) },
+                _task(task)
+            {}
+
+            // Skips count values of every lane
+            void discard(std::uint64_t count)
+            {
+                const std::uint64_t buffered = 4 - _position;
+                if(count <= buffered)
+                {
+                    _position += static_cast<unsigned>(count);
+                    return;
+                }
+                count -= buffered;
+                _counter += count / 4;
+                _position = 4;
+                if(count % 4 != 0)
+                {
+                    _block = generate(_counter++);
+                    _position = static_cast<unsigned>(count % 4);
+                }
+            }
+
+            // The 4 values of a block for every lane, as defined by Random123 with
+            // the counter { block low bits, block high bits, lane, task }
+            std::array<detail::lanes_u32, 4> generate(std::uint64_t block) const
+            {
+                constexpr std::uint64_t multiplier0 = 0xd2511f53u;
+                constexpr std::uint64_t multiplier1 = 0xcd9e8d57u;
+                constexpr std::uint32_t weyl0 = 0x9e3779b9u;
+                constexpr std::uint32_t weyl1 = 0xbb67ae85u;
+
+                std::array<detail::lanes_u32, 4> result;
+                for(std::size_t i = 0; i < detail::LANE_SIZE; ++i)
+                {
+                    std::uint32_t c0 = static_cast<std::uint32_t>(block);
+                    std::uint32_t c1 = static_cast<std::uint32_t>(block >> 32);
+                    std::uint32_t c2 = static_cast<std::uint32_t>(i);
+                    std::uint32_t c3 = _task;
+                    std::uint32_t key0 = _key[0];
+                    std::uint32_t key1 = _key[1];
+                    for(int round = 0; round < 10; ++round)
+                    {
+                        const std::uint64_t product0 = multiplier0 * c0;
+                        const std::uint64_t product1 = multiplier1 * c2;
+                        c0 = static_cast<std::uint32_t>(product1 >> 32) ^ c1 ^ key0;
+                        c1 = static_cast<std::uint32_t>(product1);
+                        c2 = static_cast<std::uint32_t>(product0 >> 32) ^ c3 ^ key1;
+                        c3 = static_cast<std::uint32_t>(product0);
+                        key0 += weyl0;
+                        key1 += weyl1;
+                    }
+                    result[0][i] = c0;
+                    result[1][i] = c1;
+                    result[2][i] = c2;
+                    result[3][i] = c3;
+                }
+                return result;
+            }
+
+        private:
+            friend detail::distributions<philox>;
+
+            detail::lanes_u32 next_lanes()
+            {
+                if(_position == 4)
+                {
+                    _block = generate(_counter++);
+                    _position = 0;
+                }
+                return _block[_position++];
+            }
+
+            std::array<std::uint32_t, 2> _key;
+            std::uint32_t _task;
+            std::uint64_t _counter = 0;
+            std::array<detail::lanes_u32, 4> _block;
+            unsigned _position = 4;
+        };
+
+        // xoshiro128** 1.1 from https://prng.di.unimi.it, with a state of 4 varying<uint32_t>.
+        // Lanes are 2^64 values apart in the sequence and tasks 2^96 values apart, so a task
+        // can use 2^32 / programCount blocks of 2^64 values per lane.
+        // Only the active lanes advance.
+        struct xoshiro128 : detail::distributions<xoshiro128>
+        {
+            explicit xoshiro128(std::uint64_t seed, std::uint32_t task = 0)
+            {
+                std::array<std::uint32_t, 4> state;
+                for(std::size_t i = 0; i < 4; i += 2)
+                {
+                    const std::uint64_t bits = detail::splitmix64(seed);
+                    state[i] = static_cast<std::uint32_t>(bits);
+                    state[i + 1] = static_cast<std::uint32_t>(bits >> 32);
+                }
+                if(task != 0)
+                    jump_scalar(state, detail::xoshiro128_power(long_jump_polynomial, task));
+                for(std::size_t lane = 0; lane < detail::LANE_SIZE; ++lane)
+                {
+                    for(std::size_t i = 0; i < 4; ++i)
+                        _state[i][lane] = state[i];
+                    jump_scalar(state, jump_polynomial);
+                }
+            }
+
+            // Advances the active lanes by programCount * 2^64 values, past the values of every lane
+            // of the task, so they don't draw what another lane drew or will draw
+            void jump()
+            {
+                jump_lanes(lanes_jump_polynomial);
+            }
+
+        private:
+            friend detail::distributions<xoshiro128>;
+
+            // x^(2^64) and x^(2^96), see detail::polynomial
+            static constexpr detail::polynomial jump_polynomial{ 0x8764000bu, 0xf542d2d3u, 0x6fa035c3u, 0x77f2db5bu };
+            static constexpr detail::polynomial long_jump_polynomial{ 0xb523952eu, 0x0b6f099fu, 0xccf5a0efu, 0x1c580662u };
+            static constexpr detail::polynomial lanes_jump_polynomial = detail::xoshiro128_power(jump_polynomial, detail::LANE_SIZE);
+
+            static void step(std::uint32_t& s0, std::uint32_t& s1, std::uint32_t& s2, std::uint32_t& s3)
+            {
+                const std::uint32_t shifted = s1 << 9;
+                s2 ^= s0;
+                s3 ^= s1;
+                s1 ^= s2;
+                s0 ^= s3;
+                s2 ^= shifted;
+                s3 = detail::rotate_left(s3, 11);
+            }
+
+            detail::lanes_u32 next_lanes()
+            {
+                detail::lanes_u32 result;
+                for(std::size_t i = 0; i < detail::LANE_SIZE; ++i)
+                {
+                    std::uint32_t s0 = _state[0][i], s1 = _state[1][i], s2 = _state[2][i], s3 = _state[3][i];
+                    result[i] = detail::rotate_left(s1 * 5, 7) * 9;
+                    step(s0, s1, s2, s3);
+                    const bool active = _current_mask._values[i];
+                    _state[0][i] = active ? s0 : _state[0][i];
+                    _state[1][i] = active ? s1 : _state[1][i];
+                    _state[2][i] = active ? s2 : _state[2][i];
+                    _state[3][i] = active ? s3 : _state[3][i];
+                }
+                return result;
+            }
+
+            static void jump_scalar(std::array<std::uint32_t, 4>& state, const detail::polynomial& jump)
+            {
+                std::array<std::uint32_t, 4> result{};
+                for(std::uint32_t word : jump)
+                {
+                    for(int bit = 0; bit < 32; ++bit)
+                    {
+                        if(word & (1u << bit))
+                            for(std::size_t i = 0; i < 4; ++i)
+                                result[i] ^= state[i];
+                        step(state[0], state[1], state[2], state[3]);
+                    }
+                }
+                state = result;
+            }
+
+            void jump_lanes(const detail::polynomial& jump)
+            {
+                std::array<detail::lanes_u32, 4> result{};
+                for(std::uint32_t word : jump)
+                {
+                    for(int bit = 0; bit < 32; ++bit)
+                    {
+                        if(word & (1u << bit))
+                            for(std::size_t i = 0; i < 4; ++i)
+                                for(std::size_t lane = 0; lane < detail::LANE_SIZE; ++lane)
+                                    result[i][lane] ^= _state[i][lane];
+                        next_lanes();
+                    }
+                }
+                for(std::size_t i = 0; i < 4; ++i)
+                    for(std::size_t lane = 0; lane < detail::LANE_SIZE; ++lane)
+                        _state[i][lane] = _current_mask._values[lane] ? result[i][lane] : _state[i][lane];
+            }
+
+            std::array<detail::lanes_u32, 4> _state;
+        };
+    }
+}
+
+#endif // RANDOM_HPP
@@ -25,9 +25,9 @@
 
 #include "varying.hpp"
 
-namespace iic
+namespace iic::inline IIC_TARGET_NAMESPACE
 {
-    bool all(const varying<bool>& input)
+    inline bool all(const varying<bool>& input)
     {
         bool val = true;
         for(const auto& lane : input._values)
@@ -35,7 +35,7 @@ namespace iic
         return val;
     }
     
-    bool any(const varying<bool>& input)
+    inline bool any(const varying<bool>& input)
     {
         bool val = false;
         for(const auto& lane : input._values)
@@ -43,11 +43,38 @@ namespace iic
         return val;
     }
     
-    bool none(const varying<bool>& input)
+    inline bool none(const varying<bool>& input)
     {
         return !any(input);
     }
     
+    // Whether every active lane holds the same value, to branch to scalar code on coherent data
+    template<typename T>
+    bool is_uniform(const detail::varying_impl<T>& input)
+    {
+        const T* first = nullptr;
+        for(std::size_t i = 0; i < programCount; ++i)
+        {
+            if(!_current_mask._values[i])
+                continue;
+            if(!first)
+                first = &input._values[i];
+            else if(!(input._values[i] == *first))
+                return false;
+        }
+        return true;
+    }
+    
+    // Value of the first active lane, T{} when no lane is active
+    template<typename T>
+    T extract_uniform(const detail::varying_impl<T>& input)
+    {
+        for(std::size_t i = 0; i < programCount; ++i)
+            if(_current_mask._values[i])
+                return input._values[i];
+        return T{};
+    }
+    
     // TODO Do more (maybe)
 }
 
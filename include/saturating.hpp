@@ -0,0 +1,216 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef SATURATING_HPP
+#define SATURATING_HPP
+
+// Arithmetic for narrow integer types (pixels, byte streams) that clamps instead of wrapping.
+// Such kernels should be compiled with one lane per byte or short of a vector register,
+// see ELEMENT_BYTES of iic_add_kernels in CMakeLists.txt.
+
+#include "varying.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    namespace detail
+    {
+        template<typename T>
+        struct wider;
+
+        template<> struct wider<std::int8_t> { using type = std::int16_t; };
+        template<> struct wider<std::uint8_t> { using type = std::uint16_t; };
+        template<> struct wider<std::int16_t> { using type = std::int32_t; };
+        template<> struct wider<std::uint16_t> { using type = std::uint32_t; };
+        template<> struct wider<std::int32_t> { using type = std::int64_t; };
+        template<> struct wider<std::uint32_t> { using type = std::uint64_t; };
+
+        // Integer twice as large as T, big enough for the product of two T
+        template<typename T>
+        using wider_t = typename wider<T>::type;
+
+        template<typename T>
+        concept narrow_integer = std::integral<T> && !std::same_as<T, bool> && sizeof(T) <= 4;
+
+        // Compares in the domain of each type, so unsigned values above the signed maximum clamp too
+        template<typename U, typename T>
+        constexpr U saturate(T value)
+        {
+            if(std::cmp_less(value, std::numeric_limits<U>::min()))
+                return std::numeric_limits<U>::min();
+            if(std::cmp_greater(value, std::numeric_limits<U>::max()))
+                return std::numeric_limits<U>::max();
+            return static_cast<U>(value);
+        }
+
+        enum class saturating_op
+        {
+            add,
+            sub,
+            avg
+        };
+
+        template<saturating_op op, typename T>
+        T saturating_lane(T a, T b)
+        {
+            using W = std::make_signed_t<wider_t<T>>;
+            W result;
+            if constexpr(op == saturating_op::add)
+                result = W(a) + W(b);
+            else if constexpr(op == saturating_op::sub)
+                result = W(a) - W(b);
+            else
+                result = (W(a) + W(b) + 1) >> 1;
+            return static_cast<T>(std::clamp<W>(result, std::numeric_limits<T>::min(), std::numeric_limits<T>::max()));
+        }
+
+        // The same operation on a whole register when the instruction exists
+        #define IIC_DEFINE_SATURATING_VECTOR(VECTOR, PREFIX) \
+        template<saturating_op op, typename T> \
+        VECTOR saturating_vector(VECTOR a, VECTOR b) \
+        { \
+            if constexpr(op == saturating_op::add && std::same_as<T, std::int8_t>) return PREFIX##_adds_epi8(a, b); \
+            else if constexpr(op == saturating_op::add && std::same_as<T, std::uint8_t>) return PREFIX##_adds_epu8(a, b); \
+            else if constexpr(op == saturating_op::add && std::same_as<T, std::int16_t>) return PREFIX##_adds_epi16(a, b); \
+            else if constexpr(op == saturating_op::add && std::same_as<T, std::uint16_t>) return PREFIX##_adds_epu16(a, b); \
+            else if constexpr(op == saturating_op::sub && std::same_as<T, std::int8_t>) return PREFIX##_subs_epi8(a, b); \
+            else if constexpr(op == saturating_op::sub && std::same_as<T, std::uint8_t>) return PREFIX##_subs_epu8(a, b); \
+            else if constexpr(op == saturating_op::sub && std::same_as<T, std::int16_t>) return PREFIX##_subs_epi16(a, b); \
+            else if constexpr(op == saturating_op::sub && std::same_as<T, std::uint16_t>) return PREFIX##_subs_epu16(a, b); \
+            else if constexpr(op == saturating_op::avg && std::same_as<T, std::uint8_t>) return PREFIX##_avg_epu8(a, b); \
+            else return PREFIX##_avg_epu16(a, b); \
+        }
+
+        template<saturating_op op, typename T>
+        constexpr bool has_saturating_vector = (op != saturating_op::avg && sizeof(T) <= 2)
+                                               || (op == saturating_op::avg && std::is_unsigned_v<T> && sizeof(T) <= 2);
+
+#if defined(__SSE2__) || defined(_M_X64)
+        IIC_DEFINE_SATURATING_VECTOR(__m128i, _mm)
+#endif
+#if defined(__AVX2__)
+        IIC_DEFINE_SATURATING_VECTOR(__m256i, _mm256)
+#endif
+#if defined(__AVX512BW__)
+        IIC_DEFINE_SATURATING_VECTOR(__m512i, _mm512)
+#endif
+
+        #undef IIC_DEFINE_SATURATING_VECTOR
+
+        template<saturating_op op, typename VECTOR, typename T>
+        void saturating_blocks(std::size_t& i, const std::array<T, LANE_SIZE>& a, const std::array<T, LANE_SIZE>& b,
+                               std::array<T, LANE_SIZE>& result)
+        {
+            constexpr std::size_t lanes_per_vector = sizeof(VECTOR) / sizeof(T);
+            for(; i + lanes_per_vector <= LANE_SIZE; i += lanes_per_vector)
+            {
+                VECTOR va, vb;
+                std::memcpy(&va, &a[i], sizeof(VECTOR));
+                std::memcpy(&vb, &b[i], sizeof(VECTOR));
+                const VECTOR vr = saturating_vector<op, T>(va, vb);
+                std::memcpy(&result[i], &vr, sizeof(VECTOR));
+            }
+        }
+
+        template<saturating_op op, typename T>
+        varying_impl<T> saturating(const varying_impl<T>& a, const varying_impl<T>& b)
+        {
+            std::array<T, LANE_SIZE> result;
+            std::size_t i = 0;
+            if constexpr(has_saturating_vector<op, T>)
+            {
+#if defined(__AVX512BW__)
+                saturating_blocks<op, __m512i>(i, a._values, b._values, result);
+#endif
+#if defined(__AVX2__)
+                saturating_blocks<op, __m256i>(i, a._values, b._values, result);
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+                saturating_blocks<op, __m128i>(i, a._values, b._values, result);
+#endif
+            }
+            for(; i < LANE_SIZE; ++i)
+                result[i] = saturating_lane<op>(a._values[i], b._values[i]);
+            return varying_impl<T>(Private{}, select_with_mask(result));
+        }
+    }
+
+    // a + b clamped to the range of T
+    template<detail::narrow_integer T>
+    detail::varying_impl<T> add_sat(const detail::varying_impl<T>& a, const detail::varying_impl<T>& b)
+    {
+        return detail::saturating<detail::saturating_op::add>(a, b);
+    }
+
+    // a - b clamped to the range of T
+    template<detail::narrow_integer T>
+    detail::varying_impl<T> sub_sat(const detail::varying_impl<T>& a, const detail::varying_impl<T>& b)
+    {
+        return detail::saturating<detail::saturating_op::sub>(a, b);
+    }
+
+    // (a + b + 1) / 2 without overflow, rounded up like ISPC avg_up
+    template<detail::narrow_integer T>
+    detail::varying_impl<T> avg(const detail::varying_impl<T>& a, const detail::varying_impl<T>& b)
+    {
+        return detail::saturating<detail::saturating_op::avg>(a, b);
+    }
+
+    // acc + a * b, with the product computed in the wider accumulator type so it can't overflow
+    template<detail::narrow_integer T>
+    detail::varying_impl<detail::wider_t<T>> mul_add_widen(const detail::varying_impl<T>& a, const detail::varying_impl<T>& b,
+                                                           const detail::varying_impl<detail::wider_t<T>>& acc)
+    {
+        using W = detail::wider_t<T>;
+        auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+        {
+            return std::array<W, detail::LANE_SIZE>{
+                static_cast<W>(acc._values[I] + static_cast<W>(a._values[I]) * static_cast<W>(b._values[I]))...
+            };
+        };
+        return detail::varying_impl<W>(detail::Private{}, detail::select_with_mask(helper(std::make_index_sequence<detail::LANE_SIZE>{})));
+    }
+
+    // Conversion to a narrower type clamping out of range values, like the pack instructions
+    template<detail::narrow_integer U, std::integral T>
+    detail::varying_impl<U> saturating_cast(const detail::varying_impl<T>& value)
+    {
+        auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+        {
+            return std::array<U, detail::LANE_SIZE>{
+                detail::saturate<U>(value._values[I])...
+            };
+        };
+        return detail::varying_impl<U>(detail::Private{}, detail::select_with_mask(helper(std::make_index_sequence<detail::LANE_SIZE>{})));
+    }
+}
+
+#endif // SATURATING_HPP
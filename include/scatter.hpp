@@ -0,0 +1,220 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef SCATTER_HPP
+#define SCATTER_HPP
+
+// Scattered read-modify-write that stay correct when several lanes target the same element
+
+#include "varying.hpp"
+#include "memory.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#if defined(__AVX512CD__)
+#include <immintrin.h>
+#endif
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    namespace detail
+    {
+        enum class scatter_op
+        {
+            add,
+            min,
+            max
+        };
+
+        template<scatter_op op, typename T>
+        T combine(const T& a, const T& b)
+        {
+            if constexpr(op == scatter_op::add)
+                return a + b;
+            else if constexpr(op == scatter_op::min)
+                return std::min(a, b);
+            else
+                return std::max(a, b);
+        }
+
+        // For every active lane, the first active lane with the same index.
+        // Inactive lanes are their own leader.
+        template<typename I>
+        std::array<std::size_t, LANE_SIZE> conflict_leaders(const std::array<I, LANE_SIZE>& index)
+        {
+            std::array<std::size_t, LANE_SIZE> leaders;
+#if defined(__AVX512CD__) && defined(__AVX512VL__)
+            if constexpr((LANE_SIZE == 8 || LANE_SIZE == 16) && sizeof(I) == 4)
+            {
+                // vpconflictd gives for every lane the bits of the previous lanes holding the same value
+                std::uint32_t active = 0;
+                for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                    active |= std::uint32_t(_current_mask._values[i]) << i;
+
+                std::array<std::uint32_t, LANE_SIZE> conflicts;
+                if constexpr(LANE_SIZE == 16)
+                    _mm512_storeu_si512(conflicts.data(), _mm512_conflict_epi32(_mm512_loadu_si512(index.data())));
+                else
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(conflicts.data()),
+                                        _mm256_conflict_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(index.data()))));
+
+                for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                {
+                    const std::uint32_t previous = _current_mask._values[i] ? conflicts[i] & active : 0;
+                    leaders[i] = previous ? std::countr_zero(previous) : i;
+                }
+                return leaders;
+            }
+#endif
+            for(std::size_t i = 0; i < LANE_SIZE; ++i)
+            {
+                leaders[i] = i;
+                if(!_current_mask._values[i])
+                    continue;
+                for(std::size_t j = 0; j < i; ++j)
+                {
+                    if(_current_mask._values[j] && index[j] == index[i])
+                    {
+                        leaders[i] = j;
+                        break;
+                    }
+                }
+            }
+            return leaders;
+        }
+
+        // Values of the lanes sharing an index are first combined in their leader lane,
+        // then only the leaders update memory so no update is lost.
+        // The updates are done one lane at a time, the hardware gathers and scatters were slower
+        // than that for the read-modify-write.
+        template<scatter_op op, typename T, typename I>
+        void scatter_combine(T* base, const varying_impl<I>& index, const varying_impl<T>& value)
+        {
+            const std::array<std::size_t, LANE_SIZE> leaders = conflict_leaders(index._values);
+            std::array<T, LANE_SIZE> merged = value._values;
+            std::array<bool, LANE_SIZE> leading;
+            for(std::size_t i = 0; i < LANE_SIZE; ++i)
+            {
+                leading[i] = _current_mask._values[i] && leaders[i] == i;
+                if(_current_mask._values[i] && leaders[i] != i)
+                    merged[leaders[i]] = combine<op>(merged[leaders[i]], value._values[i]);
+            }
+
+            for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                if(leading[i])
+                    base[index._values[i]] = combine<op>(base[index._values[i]], merged[i]);
+        }
+    }
+
+    // base[index] += value for every active lane, lanes with the same index all add their value
+    template<typename T, std::integral I>
+    void scatter_add(T* base, const detail::varying_impl<I>& index, const detail::varying_impl<T>& value)
+    {
+        detail::scatter_combine<detail::scatter_op::add>(base, index, value);
+    }
+
+    // base[index] = min(base[index], value) for every active lane
+    template<typename T, std::integral I>
+    void scatter_min(T* base, const detail::varying_impl<I>& index, const detail::varying_impl<T>& value)
+    {
+        detail::scatter_combine<detail::scatter_op::min>(base, index, value);
+    }
+
+    // base[index] = max(base[index], value) for every active lane
+    template<typename T, std::integral I>
+    void scatter_max(T* base, const detail::varying_impl<I>& index, const detail::varying_impl<T>& value)
+    {
+        detail::scatter_combine<detail::scatter_op::max>(base, index, value);
+    }
+
+    // Histogram where every lane counts in its own copy of the bins, so adding never conflicts
+    // and needs no conflict detection. The copies are laid out [bin][lane] so the lanes of a bin
+    // are contiguous, and summed when the totals are read.
+    template<typename T = std::uint32_t>
+    requires std::is_arithmetic_v<T>
+    struct histogram
+    {
+        explicit histogram(std::size_t bins):
+            _bins(bins),
+            _counts(bins * detail::LANE_SIZE)
+        {
+            assert(bins * detail::LANE_SIZE <= std::size_t(std::numeric_limits<std::int32_t>::max()));
+        }
+
+        std::size_t bins() const { return _bins; }
+
+        // Adds weight to the bin of every active lane, bins must be in [0, bins())
+        template<std::integral I>
+        void add(const detail::varying_impl<I>& bin, const detail::varying_impl<T>& weight)
+        {
+            T* counts = _counts.data();
+            for(std::size_t i = 0; i < detail::LANE_SIZE; ++i)
+                if(_current_mask._values[i])
+                    counts[std::size_t(bin._values[i]) * detail::LANE_SIZE + i] += weight._values[i];
+        }
+
+        template<std::integral I>
+        void add(const detail::varying_impl<I>& bin)
+        {
+            add(bin, detail::varying_impl<T>(T{1}));
+        }
+
+        // Count of a bin summed over the lanes
+        T operator[](std::size_t bin) const
+        {
+            const T* lanes = _counts.data() + bin * detail::LANE_SIZE;
+            return std::accumulate(lanes, lanes + detail::LANE_SIZE, T{});
+        }
+
+        // Adds the counts to totals[0, bins()), to merge histograms filled by several threads
+        void add_to(T* totals) const
+        {
+            for(std::size_t bin = 0; bin < _bins; ++bin)
+                totals[bin] += (*this)[bin];
+        }
+
+        std::vector<T> totals() const
+        {
+            std::vector<T> result(_bins);
+            add_to(result.data());
+            return result;
+        }
+
+        void clear()
+        {
+            std::fill_n(_counts.data(), _counts.padded_size(), T{});
+        }
+
+    private:
+        std::size_t _bins;
+        aligned_buffer<T> _counts;
+    };
+}
+
+#endif // SCATTER_HPP
@@ -0,0 +1,479 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef SORT_HPP
+#define SORT_HPP
+
+#include "varying.hpp"
+#include "control_flow.hpp"
+#include "memory.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    namespace detail
+    {
+        // Sorting networks need a power of two number of elements, the extra ones are filled with
+        // a value that sorts after everything else
+        constexpr std::size_t SORT_WIDTH = std::bit_ceil(LANE_SIZE);
+
+        template<typename T>
+        constexpr T sort_sentinel()
+        {
+            if constexpr(std::numeric_limits<T>::has_infinity)
+                return std::numeric_limits<T>::infinity();
+            else
+                return std::numeric_limits<T>::max();
+        }
+
+        // In a column of a bitonic network, element i is compared with element i ^ Distance
+        // and keeps the smaller one if it is in the lower half of the pair in an ascending block
+        template<std::size_t Block, std::size_t Distance>
+        constexpr bool keeps_smaller(std::size_t i)
+        {
+            return ((i & Distance) == 0) == ((i & Block) == 0);
+        }
+
+        // Values are moved along with their key
+        template<std::size_t Block, std::size_t Distance, std::size_t N, typename K, typename... V>
+        void bitonic_step(std::array<K, N>& keys, std::array<V, N>&... values)
+        {
+            auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+            {
+                const std::array<K, N> others{ keys[I ^ Distance]... };
+                const std::array<bool, N> exchange{
+                    (keeps_smaller<Block, Distance>(I) ? others[I] < keys[I] : keys[I] < others[I])...
+                };
+                keys = { (exchange[I] ? others[I] : keys[I])... };
+                if constexpr(sizeof...(V) > 0)
+                {
+                    auto follow = [&](auto& payload)
+                    {
+                        payload = { (exchange[I] ? payload[I ^ Distance] : payload[I])... };
+                    };
+                    (follow(values), ...);
+                }
+            };
+            helper(std::make_index_sequence<N>{});
+        }
+
+#if defined(__GNUC__)
+        // The compiler doesn't turn the array version into shuffles, so with GCC and Clang
+        // the network is written with vector extensions when every type fits in a vector
+        template<typename T>
+        concept vector_element = std::is_arithmetic_v<T> && !std::same_as<T, bool> && sizeof(T) <= 8;
+
+        template<typename T, std::size_t N>
+        struct native_vector_of
+        {
+            typedef T type __attribute__((vector_size(N * sizeof(T))));
+        };
+
+        template<typename T, std::size_t N>
+        using native_vector = typename native_vector_of<T, N>::type;
+
+        template<std::size_t Size>
+        using mask_element = std::conditional_t<Size == 1, std::int8_t,
+                             std::conditional_t<Size == 2, std::int16_t,
+                             std::conditional_t<Size == 4, std::int32_t, std::int64_t>>>;
+
+        template<std::size_t Block, std::size_t Distance, typename KeyVector, typename... ValueVectors>
+        void bitonic_vector_step(KeyVector& keys, ValueVectors&... values)
+        {
+            constexpr std::size_t N = sizeof(KeyVector) / sizeof(keys[0]);
+            auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+            {
+                const KeyVector others = __builtin_shufflevector(keys, keys, (I ^ Distance)...);
+                if constexpr(sizeof...(ValueVectors) == 0)
+                {
+                    const KeyVector smaller = others < keys ? others : keys;
+                    const KeyVector larger = others < keys ? keys : others;
+                    keys = __builtin_shufflevector(smaller, larger, (keeps_smaller<Block, Distance>(I) ? I : I + N)...);
+                }
+                else
+                {
+                    // Pairs are exchanged when first < second, the comparison is kept inside
+                    // each selection so the compiler splits it in registers it supports
+                    const KeyVector first = __builtin_shufflevector(others, keys, (keeps_smaller<Block, Distance>(I) ? I : I + N)...);
+                    const KeyVector second = __builtin_shufflevector(keys, others, (keeps_smaller<Block, Distance>(I) ? I : I + N)...);
+                    keys = first < second ? others : keys;
+                    auto follow = [&](auto& payload)
+                    {
+                        using element = std::remove_cvref_t<decltype(payload[0])>;
+                        using payload_mask = native_vector<mask_element<sizeof(element)>, N>;
+                        const auto moved = __builtin_shufflevector(payload, payload, (I ^ Distance)...);
+                        if constexpr(sizeof(element) == sizeof(keys[0]))
+                            payload = first < second ? moved : payload;
+                        else
+                            payload = __builtin_convertvector(first < second, payload_mask) ? moved : payload;
+                    };
+                    (follow(values), ...);
+                }
+            };
+            helper(std::make_index_sequence<N>{});
+        }
+#endif
+
+        // Calls step for every column of the blocks from Block to N, from the farthest comparisons to the nearest
+        template<std::size_t Block, std::size_t Distance, typename Step>
+        void bitonic_columns(const Step& step)
+        {
+            step(std::integral_constant<std::size_t, Block>{}, std::integral_constant<std::size_t, Distance>{});
+            if constexpr(Distance > 1)
+                bitonic_columns<Block, Distance / 2>(step);
+        }
+
+        template<std::size_t Block, std::size_t N, typename Step>
+        void bitonic_blocks(const Step& step)
+        {
+            bitonic_columns<Block, Block / 2>(step);
+            if constexpr(Block < N)
+                bitonic_blocks<Block * 2, N>(step);
+        }
+
+        template<typename Network, std::size_t N, typename K, typename... V>
+        void run_network(const Network& network, std::array<K, N>& keys, std::array<V, N>&... values)
+        {
+#if defined(__GNUC__)
+            if constexpr(vector_element<K> && (vector_element<V> && ...))
+            {
+                native_vector<K, N> key_vector;
+                std::tuple<native_vector<V, N>...> value_vectors;
+                std::memcpy(&key_vector, keys.data(), sizeof(key_vector));
+                std::apply([&](auto&... vectors) { (std::memcpy(&vectors, values.data(), sizeof(vectors)), ...); }, value_vectors);
+
+                network([&](auto block, auto distance)
+                {
+                    std::apply([&](auto&... vectors)
+                    {
+                        bitonic_vector_step<decltype(block)::value, decltype(distance)::value>(key_vector, vectors...);
+                    }, value_vectors);
+                });
+
+                std::memcpy(keys.data(), &key_vector, sizeof(key_vector));
+                std::apply([&](const auto&... vectors) { (std::memcpy(values.data(), &vectors, sizeof(vectors)), ...); }, value_vectors);
+                return;
+            }
+#endif
+            network([&](auto block, auto distance)
+            {
+                bitonic_step<decltype(block)::value, decltype(distance)::value>(keys, values...);
+            });
+        }
+
+        template<std::size_t N, typename K, typename... V>
+        void bitonic_sort(std::array<K, N>& keys, std::array<V, N>&... values)
+        {
+            if constexpr(N > 1)
+                run_network([](const auto& step) { bitonic_blocks<2, N>(step); }, keys, values...);
+        }
+
+        // Sorts a sequence that is ascending then descending
+        template<std::size_t N, typename K, typename... V>
+        void bitonic_merge(std::array<K, N>& keys, std::array<V, N>&... values)
+        {
+            if constexpr(N > 1)
+                run_network([](const auto& step) { bitonic_columns<N, N / 2>(step); }, keys, values...);
+        }
+
+        template<typename K, typename... V>
+        struct sort_buffers
+        {
+            explicit sort_buffers(std::size_t size):
+                keys(size),
+                values(aligned_buffer<V>(size)...)
+            {}
+
+            aligned_buffer<K> keys;
+            std::tuple<aligned_buffer<V>...> values;
+        };
+
+        template<typename K, typename... V>
+        void copy_runs(const sort_buffers<K, V...>& from, sort_buffers<K, V...>& to, std::size_t start, std::size_t end)
+        {
+            std::copy(from.keys.data() + start, from.keys.data() + end, to.keys.data() + start);
+            [&]<std::size_t... J>(std::index_sequence<J...>)
+            {
+                (std::copy(std::get<J>(from.values).data() + start, std::get<J>(from.values).data() + end,
+                           std::get<J>(to.values).data() + start), ...);
+            }(std::index_sequence_for<V...>{});
+        }
+
+        // Merges the sorted runs [start, middle) and [middle, end) of from into to.
+        // Every bound is a multiple of programCount from the start of the buffers.
+        // The smallest programCount elements seen so far are kept in the lower half of a network,
+        // the next chunk is taken from the run with the smallest head and goes reversed in the upper half.
+        // The first column of the merge compares the two halves, then each half is merged on its own
+        // so no vector is larger than a register.
+        template<typename K, typename... V>
+        void merge_runs(const sort_buffers<K, V...>& from, sort_buffers<K, V...>& to,
+                        std::size_t start, std::size_t middle, std::size_t end)
+        {
+            constexpr std::size_t L = LANE_SIZE;
+            constexpr std::size_t N = SORT_WIDTH;
+            using indices = std::index_sequence_for<V...>;
+
+            if(middle >= end)
+            {
+                copy_runs(from, to, start, end);
+                return;
+            }
+
+            std::array<K, N> lower_keys, upper_keys;
+            std::tuple<std::array<V, N>...> lower_values, upper_values;
+            auto transfer = [&](auto&& action)
+            {
+                [&]<std::size_t... J>(std::index_sequence<J...>)
+                {
+                    action(lower_keys, upper_keys, from.keys.data(), to.keys.data(), sort_sentinel<K>());
+                    (action(std::get<J>(lower_values), std::get<J>(upper_values),
+                            std::get<J>(from.values).data(), std::get<J>(to.values).data(), V{}), ...);
+                }(indices{});
+            };
+
+            transfer([&](auto& lower, auto&, const auto* source, auto*, const auto& padding)
+            {
+                std::copy_n(source + start, L, lower.begin());
+                std::fill(lower.begin() + L, lower.end(), padding);
+            });
+
+            std::size_t first = start + L;
+            std::size_t second = middle;
+            std::size_t output = start;
+            while(first < middle || second < end)
+            {
+                std::size_t next;
+                if(second >= end || (first < middle && !(from.keys[second] < from.keys[first])))
+                {
+                    next = first;
+                    first += L;
+                }
+                else
+                {
+                    next = second;
+                    second += L;
+                }
+
+                transfer([&](auto&, auto& upper, const auto* source, auto*, const auto& padding)
+                {
+                    std::fill(upper.begin(), upper.end() - L, padding);
+                    for(std::size_t i = 0; i < L; ++i)
+                        upper[N - 1 - i] = source[next + i];
+                });
+
+                if constexpr(sizeof...(V) == 0)
+                {
+                    for(std::size_t i = 0; i < N; ++i)
+                    {
+                        const K lower = std::min(lower_keys[i], upper_keys[i]);
+                        upper_keys[i] = std::max(lower_keys[i], upper_keys[i]);
+                        lower_keys[i] = lower;
+                    }
+                }
+                else
+                {
+                    // Comparing in every loop lets the compiler vectorize them
+                    const std::array<K, N> old_lower = lower_keys;
+                    const std::array<K, N> old_upper = upper_keys;
+                    transfer([&](auto& lower, auto& upper, const auto*, auto*, const auto&)
+                    {
+                        for(std::size_t i = 0; i < N; ++i)
+                        {
+                            const auto kept = lower[i];
+                            lower[i] = old_upper[i] < old_lower[i] ? upper[i] : kept;
+                            upper[i] = old_upper[i] < old_lower[i] ? kept : upper[i];
+                        }
+                    });
+                }
+                std::apply([&](auto&... payloads) { bitonic_merge(lower_keys, payloads...); }, lower_values);
+                std::apply([&](auto&... payloads) { bitonic_merge(upper_keys, payloads...); }, upper_values);
+
+                transfer([&](auto& lower, auto& upper, const auto*, auto* target, const auto& padding)
+                {
+                    std::copy_n(lower.begin(), L, target + output);
+                    for(std::size_t i = 0; i < L; ++i)
+                        lower[i] = L + i < N ? lower[L + i] : upper[L + i - N];
+                    std::fill(lower.begin() + L, lower.end(), padding);
+                });
+                output += L;
+            }
+
+            transfer([&](auto& lower, auto&, const auto*, auto* target, const auto&)
+            {
+                std::copy_n(lower.begin(), L, target + output);
+            });
+        }
+
+        // Merges runs of width elements two by two in [begin, end) until there is only one,
+        // from and to are swapped after each pass
+        template<typename K, typename... V>
+        void merge_passes(sort_buffers<K, V...>*& from, sort_buffers<K, V...>*& to,
+                          std::size_t begin, std::size_t end, std::size_t width)
+        {
+            for(; width < end - begin; width *= 2)
+            {
+                for(std::size_t start = begin; start < end; start += 2 * width)
+                    merge_runs(*from, *to, start, std::min(start + width, end), std::min(start + 2 * width, end));
+                std::swap(from, to);
+            }
+        }
+
+        // Number of elements merged in cache before merging across the whole array,
+        // programCount times a power of two so the runs stay aligned
+        template<typename K, typename... V>
+        constexpr std::size_t merge_block_size()
+        {
+            constexpr std::size_t cache_bytes = 32 * 1024;
+            constexpr std::size_t elements = cache_bytes / (sizeof(K) + (sizeof(V) + ... + 0));
+            return LANE_SIZE * std::bit_floor(std::max<std::size_t>(1, elements / LANE_SIZE));
+        }
+    }
+
+    // Sorts the values of the active lanes in ascending order, they stay in the active lanes
+    // and the inactive lanes are left untouched.
+    // Additional varyings are permuted the same way as keys.
+    // Keys must be totally ordered, NaN are not supported.
+    template<typename K, typename... V>
+    requires std::is_arithmetic_v<K>
+    void sort_lanes(detail::varying_impl<K>& keys, detail::varying_impl<V>&... values)
+    {
+        constexpr std::size_t N = detail::SORT_WIDTH;
+
+        std::array<K, N> sorted_keys;
+        std::tuple<std::array<V, N>...> sorted_values;
+        sorted_keys.fill(detail::sort_sentinel<K>());
+
+        // Keys equal to the padding go last without entering the network,
+        // otherwise their values could be swapped with the padding ones
+        std::array<std::size_t, detail::LANE_SIZE> lanes;
+        std::array<std::size_t, detail::LANE_SIZE> largest;
+        std::size_t count = 0;
+        std::size_t largest_count = 0;
+        for(std::size_t lane = 0; lane < detail::LANE_SIZE; ++lane)
+        {
+            if(!_current_mask._values[lane])
+                continue;
+            lanes[count + largest_count] = lane;
+            if(keys._values[lane] == detail::sort_sentinel<K>())
+            {
+                largest[largest_count++] = lane;
+                continue;
+            }
+            sorted_keys[count] = keys._values[lane];
+            std::apply([&](auto&... payloads) { ((payloads[count] = values._values[lane]), ...); }, sorted_values);
+            ++count;
+        }
+
+        std::apply([&](auto&... payloads) { detail::bitonic_sort(sorted_keys, payloads...); }, sorted_values);
+
+        const std::tuple<detail::varying_impl<V>...> original_values(values...);
+
+        for(std::size_t i = 0; i < count; ++i)
+        {
+            keys._values[lanes[i]] = sorted_keys[i];
+            std::apply([&](const auto&... payloads) { ((values._values[lanes[i]] = payloads[i]), ...); }, sorted_values);
+        }
+        for(std::size_t i = 0; i < largest_count; ++i)
+        {
+            keys._values[lanes[count + i]] = detail::sort_sentinel<K>();
+            std::apply([&](const auto&... payloads) { ((values._values[lanes[count + i]] = payloads._values[largest[i]]), ...); }, original_values);
+        }
+    }
+
+    // Sorts keys[0, size) in ascending order. Each chunk of programCount elements is sorted
+    // with sort_lanes, then sorted runs are merged two by two with bitonic merge networks.
+    // Arrays given after size are permuted the same way as keys.
+    template<typename K, typename... V>
+    requires std::is_arithmetic_v<K>
+    void sort(K* keys, std::size_t size, V*... values)
+    {
+        if constexpr(sizeof...(V) > 0)
+        {
+            // Same as in sort_lanes, keys equal to the padding are moved to the end beforehand
+            std::size_t last = size;
+            for(std::size_t i = 0; i < last;)
+            {
+                if(keys[i] == detail::sort_sentinel<K>())
+                {
+                    --last;
+                    std::swap(keys[i], keys[last]);
+                    (std::swap(values[i], values[last]), ...);
+                }
+                else
+                    ++i;
+            }
+            size = last;
+        }
+
+        if(size < 2)
+            return;
+
+        using indices = std::index_sequence_for<V...>;
+        detail::sort_buffers<K, V...> source(size);
+        detail::sort_buffers<K, V...> target(size);
+        std::fill(source.keys.end(), source.keys.data() + source.keys.padded_size(), detail::sort_sentinel<K>());
+
+        iic_foreach(i : range(std::size_t{0}, size))
+        {
+            detail::varying_impl<K> chunk = *(keys + i);
+            std::tuple<detail::varying_impl<V>...> chunk_values(detail::varying_impl<V>(*(values + i))...);
+            std::apply([&](auto&... payloads) { sort_lanes(chunk, payloads...); }, chunk_values);
+
+            source.keys.store(i, chunk);
+            [&]<std::size_t... J>(std::index_sequence<J...>)
+            {
+                (std::get<J>(source.values).store(i, std::get<J>(chunk_values)), ...);
+            }(indices{});
+        }
+
+        // Runs are first merged inside blocks small enough to stay in cache, then across blocks
+        const std::size_t padded = source.keys.padded_size();
+        const std::size_t block = detail::merge_block_size<K, V...>();
+        detail::sort_buffers<K, V...>* from = &source;
+        detail::sort_buffers<K, V...>* to = &target;
+        for(std::size_t begin = 0; begin < padded; begin += block)
+        {
+            const std::size_t end = std::min(begin + block, padded);
+            detail::sort_buffers<K, V...>* block_from = from;
+            detail::sort_buffers<K, V...>* block_to = to;
+            detail::merge_passes(block_from, block_to, begin, end, detail::LANE_SIZE);
+            if(block_from != from)
+                detail::copy_runs(*block_from, *from, begin, end);
+        }
+        detail::merge_passes(from, to, 0, padded, block);
+
+        std::copy_n(from->keys.data(), size, keys);
+        [&]<std::size_t... J>(std::index_sequence<J...>)
+        {
+            (std::copy_n(std::get<J>(from->values).data(), size, values), ...);
+        }(indices{});
+    }
+}
+
+#endif // SORT_HPP
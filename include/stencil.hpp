@@ -0,0 +1,327 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef STENCIL_HPP
+#define STENCIL_HPP
+
+// Foreach over 1-D and 2-D arrays giving the body the neighbours of every lane.
+// Each chunk is loaded once and kept in a window with the chunks before and after it,
+// a neighbour at offset d is then the window read d elements further instead of a gather.
+
+#include "varying.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    namespace detail
+    {
+        // [previous chunk | current chunk | next chunk] of a row, zero outside of the row
+        template<typename T>
+        struct stencil_window
+        {
+            std::array<T, 3 * LANE_SIZE> values{};
+
+            // Loads the chunk of row starting at start as the next one, row can be null for a missing row
+            void load_next(const T* row, std::size_t start, std::size_t size)
+            {
+                T* next = values.data() + 2 * LANE_SIZE;
+                const std::size_t count = row != nullptr && start < size ? std::min(LANE_SIZE, size - start) : 0;
+                if(count == LANE_SIZE)
+                    std::copy_n(row + start, LANE_SIZE, next);
+                else
+                {
+                    std::copy_n(row + start, count, next);
+                    std::fill(next + count, next + LANE_SIZE, T{});
+                }
+            }
+
+            void shift()
+            {
+                for(std::size_t i = 0; i < 2 * LANE_SIZE; ++i)
+                    values[i] = values[i + LANE_SIZE];
+            }
+
+            void reset(const T* row, std::size_t size)
+            {
+                load_next(row, 0, size);
+                shift();
+                std::fill_n(values.begin(), LANE_SIZE, T{});
+                load_next(row, LANE_SIZE, size);
+            }
+
+            // Lane i gets the element at offset from the element of lane i in the current chunk
+            std::array<T, LANE_SIZE> lanes(int offset) const
+            {
+                std::array<T, LANE_SIZE> result;
+                std::copy_n(values.data() + LANE_SIZE + offset, LANE_SIZE, result.begin());
+                return select_with_mask(result);
+            }
+        };
+
+        // Lanes of the chunk starting at start that are in [0, size)
+        inline std::array<bool, LANE_SIZE> lanes_before(std::size_t start, std::size_t size)
+        {
+            std::array<bool, LANE_SIZE> result;
+            for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                result[i] = start + i < size;
+            return result;
+        }
+
+        // Active lanes whose element at offset is within [0, size)
+        inline mask_t lanes_in_bounds(std::size_t start, std::ptrdiff_t offset, std::size_t size)
+        {
+            std::array<bool, LANE_SIZE> result;
+            for(std::size_t i = 0; i < LANE_SIZE; ++i)
+            {
+                const std::ptrdiff_t position = static_cast<std::ptrdiff_t>(start + i) + offset;
+                result[i] = _current_mask._values[i] && position >= 0 && position < static_cast<std::ptrdiff_t>(size);
+            }
+            return mask_t(Private{}, result);
+        }
+
+        inline varying_impl<std::size_t> chunk_indices(std::size_t start)
+        {
+            std::array<std::size_t, LANE_SIZE> result;
+            for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                result[i] = start + i;
+            return varying_impl<std::size_t>(Private{}, select_with_mask(result));
+        }
+
+        template<typename T, std::size_t Radius>
+        struct stencil_state_1d
+        {
+            using Value = std::remove_cv_t<T>;
+
+            const T* data;
+            std::size_t size;
+            std::size_t start = 0;
+            bool started = false;
+            stencil_window<Value> window;
+
+            bool next()
+            {
+                if(!started)
+                {
+                    window.reset(data, size);
+                    started = true;
+                }
+                else
+                {
+                    start += LANE_SIZE;
+                    window.shift();
+                    window.load_next(data, start + LANE_SIZE, size);
+                }
+                _current_mask._values = lanes_before(start, size);
+                return start < size;
+            }
+        };
+
+        // What the body of a 1-D stencil foreach gets
+        template<typename T, std::size_t Radius>
+        struct stencil_point_1d
+        {
+            const stencil_state_1d<T, Radius>* state;
+
+            // data[i + offset] for the element i of every lane, 0 outside of the array
+            varying_impl<std::remove_cv_t<T>> at(int offset) const
+            {
+                assert(offset >= -static_cast<int>(Radius) && offset <= static_cast<int>(Radius));
+                return varying_impl<std::remove_cv_t<T>>(Private{}, state->window.lanes(offset));
+            }
+
+            // Active lanes whose element at offset is in the array
+            mask_t in_bounds(int offset) const
+            {
+                return lanes_in_bounds(state->start, offset, state->size);
+            }
+
+            varying_impl<std::size_t> index() const
+            {
+                return chunk_indices(state->start);
+            }
+        };
+
+        template<typename T, std::size_t Radius>
+        struct stencil_state_2d
+        {
+            using Value = std::remove_cv_t<T>;
+
+            const T* data;
+            std::size_t width, height, stride;
+            std::size_t x = 0, y = 0;
+            bool started = false;
+            // One window per row from y - Radius to y + Radius
+            std::array<stencil_window<Value>, 2 * Radius + 1> windows;
+
+            const T* row(std::size_t window) const
+            {
+                const std::ptrdiff_t index = static_cast<std::ptrdiff_t>(y + window) - static_cast<std::ptrdiff_t>(Radius);
+                return index >= 0 && index < static_cast<std::ptrdiff_t>(height) ? data + index * stride : nullptr;
+            }
+
+            void start_row()
+            {
+                for(std::size_t i = 0; i < windows.size(); ++i)
+                    windows[i].reset(row(i), width);
+            }
+
+            bool next()
+            {
+                if(!started)
+                {
+                    started = true;
+                    if(width != 0)
+                        start_row();
+                }
+                else if(x + LANE_SIZE < width)
+                {
+                    x += LANE_SIZE;
+                    for(std::size_t i = 0; i < windows.size(); ++i)
+                    {
+                        windows[i].shift();
+                        windows[i].load_next(row(i), x + LANE_SIZE, width);
+                    }
+                }
+                else
+                {
+                    x = 0;
+                    ++y;
+                    if(y < height)
+                        start_row();
+                }
+                _current_mask._values = lanes_before(x, width);
+                return width != 0 && y < height;
+            }
+        };
+
+        // What the body of a 2-D stencil foreach gets, the lanes are consecutive elements of a row
+        template<typename T, std::size_t Radius>
+        struct stencil_point_2d
+        {
+            const stencil_state_2d<T, Radius>* state;
+
+            // Element (x + dx, y + dy) for the element (x, y) of every lane, 0 outside of the array
+            varying_impl<std::remove_cv_t<T>> at(int dx, int dy) const
+            {
+                assert(dx >= -static_cast<int>(Radius) && dx <= static_cast<int>(Radius));
+                assert(dy >= -static_cast<int>(Radius) && dy <= static_cast<int>(Radius));
+                return varying_impl<std::remove_cv_t<T>>(Private{}, state->windows[dy + static_cast<int>(Radius)].lanes(dx));
+            }
+
+            mask_t in_bounds(int dx, int dy) const
+            {
+                const std::ptrdiff_t row = static_cast<std::ptrdiff_t>(state->y) + dy;
+                if(row < 0 || row >= static_cast<std::ptrdiff_t>(state->height))
+                    return mask_t(false);
+                return lanes_in_bounds(state->x, dx, state->width);
+            }
+
+            varying_impl<std::size_t> x() const
+            {
+                return chunk_indices(state->x);
+            }
+
+            std::size_t y() const
+            {
+                return state->y;
+            }
+
+            // Offset of the element of every lane from data
+            varying_impl<std::size_t> index() const
+            {
+                return x() + state->y * state->stride;
+            }
+        };
+
+        template<typename State, typename Point>
+        struct stencil_range
+        {
+            State state;
+
+            struct iterator
+            {
+                State& state;
+
+                bool operator!=(const iterator& other)
+                {
+                    return state.next();
+                }
+
+                Point operator*()
+                {
+                    return { &state };
+                }
+
+                iterator& operator++()
+                {
+                    return *this;
+                }
+            };
+
+            iterator begin()
+            {
+                return iterator{state};
+            }
+
+            iterator end()
+            {
+                return iterator{state};
+            }
+        };
+    }
+
+    // iic_foreach(point : iic::stencil(data, n)) runs over data[0, n) with point.at(-1), point.at(0)
+    // and point.at(1) giving the neighbours of every lane. Radius is the largest offset used,
+    // at most programCount.
+    template<std::size_t Radius = 1, typename T>
+    requires (Radius <= detail::LANE_SIZE)
+    detail::stencil_range<detail::stencil_state_1d<T, Radius>, detail::stencil_point_1d<T, Radius>>
+    stencil(const T* data, std::size_t size)
+    {
+        return { { data, size } };
+    }
+
+    // 2-D version over a width x height array whose rows start stride elements apart,
+    // point.at(dx, dy) gives the neighbours. The loop goes through the rows one chunk at a time.
+    template<std::size_t Radius = 1, typename T>
+    requires (Radius <= detail::LANE_SIZE)
+    detail::stencil_range<detail::stencil_state_2d<T, Radius>, detail::stencil_point_2d<T, Radius>>
+    stencil(const T* data, std::size_t width, std::size_t height, std::size_t stride)
+    {
+        return { { data, width, height, stride } };
+    }
+
+    template<std::size_t Radius = 1, typename T>
+    requires (Radius <= detail::LANE_SIZE)
+    detail::stencil_range<detail::stencil_state_2d<T, Radius>, detail::stencil_point_2d<T, Radius>>
+    stencil(const T* data, std::size_t width, std::size_t height)
+    {
+        return stencil<Radius>(data, width, height, width);
+    }
+}
+
+#endif // STENCIL_HPP
@@ -0,0 +1,232 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef STREAMING_HPP
+#define STREAMING_HPP
+
+#include "varying.hpp"
+#include "control_flow.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define IIC_HAS_STREAMING_STORES 1
+#endif
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    namespace detail
+    {
+        constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+        // Prefetch for a single use, so the line doesn't push useful data out of the cache
+        inline void prefetch_once(const void* address)
+        {
+#if defined(IIC_HAS_STREAMING_STORES)
+            _mm_prefetch(static_cast<const char*>(address), _MM_HINT_NTA);
+#elif defined(__GNUC__)
+            __builtin_prefetch(address, 0, 0);
+#endif
+#if defined(__GNUC__)
+            // GCC sees no side effect in a prefetch, so it would delete the calls of the functions that only prefetch
+            asm volatile("" : : "r"(address));
+#endif
+        }
+
+        template<typename T>
+        void stream_store(T* address, const T& value)
+        {
+#if defined(IIC_HAS_STREAMING_STORES)
+            if constexpr(std::is_trivially_copyable_v<T> && sizeof(T) == 4)
+            {
+                _mm_stream_si32(reinterpret_cast<int*>(address), std::bit_cast<int>(value));
+                return;
+            }
+#if defined(__x86_64__) || defined(_M_X64)
+            else if constexpr(std::is_trivially_copyable_v<T> && sizeof(T) == 8)
+            {
+                _mm_stream_si64(reinterpret_cast<long long*>(address), std::bit_cast<long long>(value));
+                return;
+            }
+#endif
+#endif
+            *address = value;
+        }
+
+        // Write to memory that won't be read again soon, bypassing the caches
+        template<typename T>
+        struct nontemporal_reference
+        {
+            varying_impl<T*> pointer;
+
+            template<typename U>
+            requires std::convertible_to<U, T>
+            nontemporal_reference& operator=(const varying_impl<U>& other)
+            {
+                const varying_impl<T> values(other);
+#if defined(IIC_HAS_STREAMING_STORES)
+                if constexpr(std::is_trivially_copyable_v<T> && (sizeof(T) * LANE_SIZE) % 16 == 0)
+                {
+                    // Whole chunk of contiguous aligned memory, the most common case in a foreach
+                    if(is_full_aligned_chunk())
+                    {
+                        auto destination = reinterpret_cast<__m128i*>(pointer._values[0]);
+                        for(std::size_t i = 0; i < sizeof(T) * LANE_SIZE / 16; ++i)
+                        {
+                            __m128i block;
+                            std::memcpy(&block, reinterpret_cast<const char*>(values._values.data()) + i * 16, 16);
+                            _mm_stream_si128(destination + i, block);
+                        }
+                        return *this;
+                    }
+                }
+#endif
+                auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+                {
+                    (
+                        [&]()
+                        {
+                            if(_current_mask._values[I])
+                                stream_store(pointer._values[I], values._values[I]);
+                        }(),...
+                    );
+                };
+                helper(std::make_index_sequence<LANE_SIZE>{});
+                return *this;
+            }
+
+        private:
+            bool is_full_aligned_chunk() const
+            {
+                auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+                {
+                    return ((_current_mask._values[I] && pointer._values[I] == pointer._values[0] + I) && ...);
+                };
+                return reinterpret_cast<std::uintptr_t>(pointer._values[0]) % 16 == 0
+                       && helper(std::make_index_sequence<LANE_SIZE>{});
+            }
+        };
+    }
+
+    // Turns a write through a varying pointer into non-temporal stores:
+    //     iic::nontemporal(*(out + i)) = a * b;
+    // Only worth it for memory written once and not read back soon.
+    // Streaming stores are weakly ordered, call iic::stream_fence() before
+    // handing the data to another thread (streaming foreach does it when it ends).
+    template<typename T>
+    detail::nontemporal_reference<T> nontemporal(const detail::varying_reference<T>& reference)
+    {
+        return { reference.pointer };
+    }
+
+    inline void stream_fence()
+    {
+#if defined(IIC_HAS_STREAMING_STORES)
+        _mm_sfence();
+#endif
+    }
+
+    // A range that prefetches the data of some arrays a given number of elements
+    // ahead of the chunk being processed.
+    template<typename T, typename... Elements>
+    struct streaming_range
+    {
+        streaming_range(range<T> r, std::size_t distance, const Elements*... arrays):
+            base(r), distance(distance), arrays(arrays...) {}
+
+        ~streaming_range()
+        {
+            stream_fence();
+        }
+
+        range<T> base;
+        std::size_t distance;
+        std::tuple<const Elements*...> arrays;
+
+        struct iterator
+        {
+            typename range<T>::iterator current;
+            const streaming_range& parent;
+
+            bool operator!=(const iterator& other)
+            {
+                return current != other.current;
+            }
+
+            detail::varying_impl<T> operator*()
+            {
+                // Signed so ranges starting below 0 prefetch too
+                const std::ptrdiff_t ahead = static_cast<std::ptrdiff_t>(current.current) + static_cast<std::ptrdiff_t>(parent.distance);
+                if(ahead < static_cast<std::ptrdiff_t>(current.finish))
+                {
+                    std::apply([&](const auto*... arrays)
+                    {
+                        (prefetch_chunk(arrays + ahead), ...);
+                    }, parent.arrays);
+                }
+                return *current;
+            }
+
+            iterator& operator++()
+            {
+                ++current;
+                return *this;
+            }
+
+        private:
+            // Every cache line the chunk touches, the first and last ones may be partly outside of it
+            template<typename E>
+            static void prefetch_chunk(const E* chunk)
+            {
+                const std::uintptr_t start = reinterpret_cast<std::uintptr_t>(chunk);
+                const std::uintptr_t end = start + sizeof(E) * detail::LANE_SIZE;
+                for(std::uintptr_t line = start & ~(detail::CACHE_LINE_SIZE - 1); line < end; line += detail::CACHE_LINE_SIZE)
+                    detail::prefetch_once(reinterpret_cast<const void*>(line));
+            }
+        };
+
+        iterator begin()
+        {
+            return iterator{base.begin(), *this};
+        }
+
+        iterator end()
+        {
+            return iterator{base.end(), *this};
+        }
+    };
+
+    // iic_foreach(i : iic::streaming(iic::range(0, n), 512, a, b)) prefetches
+    // a[i + 512] and b[i + 512] while working on a[i] and b[i]
+    template<typename T, typename... Elements>
+    streaming_range<T, Elements...> streaming(range<T> r, std::size_t distance, const Elements*... arrays)
+    {
+        return streaming_range<T, Elements...>(r, distance, arrays...);
+    }
+}
+
+#endif // STREAMING_HPP
@@ -0,0 +1,381 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+// Timeline of the SPMD regions of every thread, written as Chrome trace events
+// (chrome://tracing or https://ui.perfetto.dev).
+//
+// With IIC_TRACE defined in the whole program (the IIC_TRACE CMake option), every thread records in
+// its own ring buffer, without locks, the iic_foreach and iic_unmasked regions, the chunks of iic::range,
+// the pieces of parallel iic::transform and iic::for_each, the varying iic_if where only some of
+// the active lanes take the branch, and the regions marked with iic::trace::scope:
+//
+//     {
+//         iic::trace::scope task("blur rows");
+//         iic_foreach(i : iic::range(0, n)) ...
+//     }
+//     iic::trace::write_chrome_json("trace.json");
+//
+// Timestamps are read with rdtsc on x86. Only the last BUFFER_EVENTS events of a thread are kept,
+// and the buffers should be written while the traced threads are idle. The buffer of a thread that
+// ends is given to the next thread that starts, so a trace row is a worker slot rather than one thread,
+// and programs starting threads again and again use as many buffers as they have threads at once.
+// Without IIC_TRACE, the hooks and scopes do nothing and take no space.
+
+#include "varying.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Only data here, shared by the code of every target so all of it lands in one trace
+namespace iic::trace_storage
+{
+    struct event
+    {
+        const char* name;
+        std::uint64_t start;
+        std::uint64_t duration;
+        std::int64_t value;
+        bool instant;
+    };
+
+    inline constexpr std::size_t BUFFER_EVENTS = 1 << 16;
+
+    // Written by its thread only
+    struct thread_buffer
+    {
+        unsigned id = 0;
+        std::unique_ptr<event[]> events = std::make_unique<event[]>(BUFFER_EVENTS);
+        std::atomic<std::uint64_t> written{0};
+        thread_buffer* next = nullptr;
+        // In the free list of the registry when its thread ended
+        thread_buffer* next_free = nullptr;
+    };
+
+    // Buffers are never freed: when its thread ends a buffer goes to the free list, keeping its events
+    // until they are written or cleared, and the next thread starting takes it.
+    // The registry has no destructor and is initialized at compile time, so no code of a target
+    // runs to set it up or tear it down.
+    struct registry
+    {
+        std::mutex mutex;
+        thread_buffer* first = nullptr;
+        thread_buffer* free = nullptr;
+        unsigned count = 0;
+        // Time of the first buffer, to measure the ticks per microsecond
+        std::uint64_t origin_ticks = 0;
+        std::chrono::steady_clock::time_point origin_time;
+    };
+
+    static_assert(std::is_trivially_destructible_v<registry>);
+
+    inline constinit registry buffers;
+    inline constinit thread_local thread_buffer* local_buffer = nullptr;
+}
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    namespace detail
+    {
+        inline std::uint64_t trace_ticks()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+        }
+
+        // Gives the buffer of its thread back to the registry when the thread ends.
+        // Per target, only the one of the target that took the buffer is constructed.
+        struct trace_buffer_owner
+        {
+            trace_storage::thread_buffer* buffer = nullptr;
+
+            ~trace_buffer_owner()
+            {
+                if(!buffer)
+                    return;
+                const std::lock_guard lock(trace_storage::buffers.mutex);
+                buffer->next_free = trace_storage::buffers.free;
+                trace_storage::buffers.free = buffer;
+                if(trace_storage::local_buffer == buffer)
+                    trace_storage::local_buffer = nullptr;
+            }
+        };
+
+        inline thread_local trace_buffer_owner trace_owner;
+
+        inline trace_storage::thread_buffer& trace_buffer()
+        {
+            if(!trace_storage::local_buffer)
+            {
+                const std::lock_guard lock(trace_storage::buffers.mutex);
+                trace_storage::thread_buffer* buffer = trace_storage::buffers.free;
+                if(buffer)
+                    trace_storage::buffers.free = buffer->next_free;
+                else
+                {
+                    buffer = new trace_storage::thread_buffer;
+                    if(trace_storage::buffers.count == 0)
+                    {
+                        trace_storage::buffers.origin_ticks = trace_ticks();
+                        trace_storage::buffers.origin_time = std::chrono::steady_clock::now();
+                    }
+                    buffer->id = trace_storage::buffers.count++;
+                    buffer->next = trace_storage::buffers.first;
+                    trace_storage::buffers.first = buffer;
+                }
+                trace_storage::local_buffer = buffer;
+                trace_owner.buffer = buffer;
+            }
+            return *trace_storage::local_buffer;
+        }
+
+        inline void trace_record(const char* name, std::uint64_t start, std::uint64_t duration, std::int64_t value, bool instant)
+        {
+            trace_storage::thread_buffer& buffer = trace_buffer();
+            const std::uint64_t written = buffer.written.load(std::memory_order_relaxed);
+            buffer.events[written % trace_storage::BUFFER_EVENTS] = { name, start, duration, value, instant };
+            buffer.written.store(written + 1, std::memory_order_release);
+        }
+
+        // Value shown with a chunk, its first index when there is one
+        template<typename T>
+        std::int64_t trace_value(const T& value)
+        {
+            if constexpr(std::is_arithmetic_v<T>)
+                return static_cast<std::int64_t>(value);
+            else
+                return 0;
+        }
+
+#ifdef IIC_TRACE
+        // Records the time from its construction to its destruction
+        struct trace_span
+        {
+            const char* name;
+            std::int64_t value = 0;
+            std::uint64_t start = trace_ticks();
+
+            ~trace_span()
+            {
+                trace_record(name, start, trace_ticks() - start, value, false);
+            }
+        };
+
+        // Chunk of a range being run, ended by the next one or by the end of the loop
+        struct trace_chunk
+        {
+            std::uint64_t start = 0;
+            std::int64_t first = 0;
+            bool running = false;
+
+            void begin(std::int64_t index)
+            {
+                end();
+                start = trace_ticks();
+                first = index;
+                running = true;
+            }
+
+            void end()
+            {
+                if(running)
+                    trace_record("chunk", start, trace_ticks() - start, first, false);
+                running = false;
+            }
+
+            ~trace_chunk()
+            {
+                end();
+            }
+        };
+
+        // Some of the active lanes took a varying branch and the others didn't
+        inline void trace_divergence(const std::array<bool, LANE_SIZE>& before, const std::array<bool, LANE_SIZE>& after)
+        {
+            const auto active_before = std::count(before.begin(), before.end(), true);
+            const auto active_after = std::count(after.begin(), after.end(), true);
+            if(active_after != 0 && active_after != active_before)
+                trace_record("divergent if", trace_ticks(), 0, active_after, true);
+        }
+#else
+        struct trace_span
+        {
+            trace_span(const char*, std::int64_t = 0) {}
+        };
+
+        struct trace_chunk
+        {
+            void begin(std::int64_t) {}
+            void end() {}
+        };
+
+        inline void trace_divergence(const std::array<bool, LANE_SIZE>&, const std::array<bool, LANE_SIZE>&) {}
+#endif
+    }
+
+    namespace trace
+    {
+        // Region of the timeline named after what the thread is doing
+        struct scope
+        {
+            explicit scope(const char* name, std::int64_t value = 0):
+                span{ name, value }
+            {}
+
+            scope(const scope&) = delete;
+            scope& operator=(const scope&) = delete;
+
+        private:
+            [[no_unique_address]] detail::trace_span span;
+        };
+
+        // Point in the timeline, with a value shown in its details
+        inline void instant(const char* name, std::int64_t value = 0)
+        {
+#ifdef IIC_TRACE
+            detail::trace_record(name, detail::trace_ticks(), 0, value, true);
+#else
+            (void)name;
+            (void)value;
+#endif
+        }
+
+        // Writes the events of every thread as trace event JSON
+        inline void write_chrome_json(std::ostream& out)
+        {
+            const std::lock_guard lock(trace_storage::buffers.mutex);
+
+            // Ticks per microsecond, measured since the first event
+            double ticks_per_microsecond = 1;
+            if(trace_storage::buffers.count != 0)
+            {
+                auto elapsed = std::chrono::steady_clock::now() - trace_storage::buffers.origin_time;
+                if(elapsed < std::chrono::milliseconds(10))
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10) - elapsed);
+                    elapsed = std::chrono::steady_clock::now() - trace_storage::buffers.origin_time;
+                }
+                const std::uint64_t ticks = detail::trace_ticks() - trace_storage::buffers.origin_ticks;
+                ticks_per_microsecond = static_cast<double>(ticks) / std::chrono::duration<double, std::micro>(elapsed).count();
+            }
+            const auto microseconds = [&](std::uint64_t ticks)
+            {
+                return static_cast<double>(ticks) / ticks_per_microsecond;
+            };
+            const auto write_name = [&](const char* name)
+            {
+                out << '"';
+                for(; *name; ++name)
+                {
+                    if(*name == '"' || *name == '\\')
+                        out << '\\';
+                    out << *name;
+                }
+                out << '"';
+            };
+
+            const std::ios_base::fmtflags flags = out.flags();
+            const std::streamsize precision = out.precision();
+            out << std::fixed << std::setprecision(3);
+            // Time 0 is the oldest event kept
+            std::uint64_t origin = UINT64_MAX;
+            for(const trace_storage::thread_buffer* buffer = trace_storage::buffers.first; buffer; buffer = buffer->next)
+            {
+                const std::uint64_t written = buffer->written.load(std::memory_order_acquire);
+                const std::uint64_t oldest = written > trace_storage::BUFFER_EVENTS ? written - trace_storage::BUFFER_EVENTS : 0;
+                for(std::uint64_t i = oldest; i < written; ++i)
+                    origin = std::min(origin, buffer->events[i % trace_storage::BUFFER_EVENTS].start);
+            }
+
+            out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+            bool first = true;
+            for(const trace_storage::thread_buffer* buffer = trace_storage::buffers.first; buffer; buffer = buffer->next)
+            {
+                out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+                    << ",\"args\":{\"name\":\"thread " << buffer->id << "\"}}";
+                first = false;
+
+                const std::uint64_t written = buffer->written.load(std::memory_order_acquire);
+                const std::uint64_t oldest = written > trace_storage::BUFFER_EVENTS ? written - trace_storage::BUFFER_EVENTS : 0;
+                for(std::uint64_t i = oldest; i < written; ++i)
+                {
+                    const trace_storage::event& e = buffer->events[i % trace_storage::BUFFER_EVENTS];
+                    out << ",\n{\"name\":";
+                    write_name(e.name);
+                    out << ",\"pid\":1,\"tid\":" << buffer->id << ",\"ts\":" << microseconds(e.start - origin);
+                    if(e.instant)
+                        out << ",\"ph\":\"i\",\"s\":\"t\"";
+                    else
+                        out << ",\"ph\":\"X\",\"dur\":" << microseconds(e.duration);
+                    out << ",\"args\":{\"value\":" << e.value << "}}";
+                }
+            }
+            out << "\n]}\n";
+            out.flags(flags);
+            out.precision(precision);
+        }
+
+        inline bool write_chrome_json(const std::string& path)
+        {
+            std::ofstream file(path);
+            write_chrome_json(file);
+            return static_cast<bool>(file);
+        }
+
+        // Buffers allocated so far, the most threads that recorded events at the same time
+        inline unsigned buffer_count()
+        {
+            const std::lock_guard lock(trace_storage::buffers.mutex);
+            return trace_storage::buffers.count;
+        }
+
+        // Drops the events recorded so far
+        inline void clear()
+        {
+            const std::lock_guard lock(trace_storage::buffers.mutex);
+            for(trace_storage::thread_buffer* buffer = trace_storage::buffers.first; buffer; buffer = buffer->next)
+                buffer->written.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+#endif // TRACE_HPP
@@ -23,17 +23,38 @@
 #ifndef VARYING_HPP
 #define VARYING_HPP
 
+#include <algorithm>
 #include <concepts>
 #include <cstddef>
 #include <array>
-#include <iosfwd>
-
-
-namespace iic
+#include <ostream>
+#include <type_traits>
+#include <utility>
+
+// Number of lanes, and name of the instruction set the translation unit is compiled for.
+// Everything is declared in a namespace named after both (e.g. target_avx2_x8) so that
+// translation units compiled for different targets can be linked together (see dispatch.hpp).
+#ifndef IIC_LANE_SIZE
+#define IIC_LANE_SIZE 4
+#endif
+
+#ifndef IIC_TARGET
+#define IIC_TARGET generic
+#endif
+
+#define IIC_INTERNAL_CONCAT(a, b) a##b
+#define IIC_INTERNAL_CAT(a, b) IIC_INTERNAL_CONCAT(a, b)
+#define IIC_TARGET_NAMESPACE IIC_INTERNAL_CAT(IIC_INTERNAL_CAT(target_, IIC_TARGET), IIC_INTERNAL_CAT(_x, IIC_LANE_SIZE))
+
+namespace iic::inline IIC_TARGET_NAMESPACE
 {
+    // See varying_view.hpp
+    template<typename T>
+    struct varying_view;
+
     namespace detail
     {
-        constexpr size_t LANE_SIZE = 4;
+        constexpr size_t LANE_SIZE = IIC_LANE_SIZE;
 
 
         #define FOR_ALL_ASSIGNABLE_OP(MACRO) \
@@ -111,7 +132,11 @@ namespace iic
             template<typename U> \
             varying_impl& operator OP##=(const varying_impl<U>& other);\
             template<typename U> \
-            varying_impl& operator OP##=(const U& other);
+            varying_impl& operator OP##=(const U& other);\
+            template<typename U> \
+            varying_impl& operator OP##=(const varying_reference<U>& other);\
+            template<typename U> \
+            varying_impl& operator OP##=(const varying_view<U>& other);
             FOR_ALL_ASSIGNABLE_OP(DECLARE_ASSIGN_OP)
             #undef DECLARE_ASSIGN_OP
             
@@ -147,7 +172,7 @@ namespace iic
             // Implementation detail but it is easier for this PoC to have this public
             std::array<T, LANE_SIZE> _values;
 
-            varying_impl(Private token, const std::array<T, LANE_SIZE>& values) :
+            constexpr varying_impl(Private token, const std::array<T, LANE_SIZE>& values) :
                 _values{values} {}
         };
         
@@ -156,8 +181,10 @@ namespace iic
         {
             varying_impl<T*> pointer;
             
-            // Read from reference
-            operator varying_impl<std::remove_cv_t<T>>() const;
+            // Read from reference, converting the loaded lanes if needed
+            template<typename U>
+            requires std::convertible_to<std::remove_cv_t<T>, U>
+            operator varying_impl<U>() const;
             
             // Write to reference
             template<typename U>
@@ -166,7 +193,7 @@ namespace iic
         };
 
         template<std::size_t... I>
-        std::array<bool, LANE_SIZE> all_true(std::index_sequence<I...>)
+        constexpr std::array<bool, LANE_SIZE> all_true(std::index_sequence<I...>)
         {
             return {
                 ((void)I, true)...
@@ -182,7 +209,7 @@ namespace iic
 
     using mask_t = varying<bool>;
 
-    thread_local mask_t _current_mask(detail::Private{}, detail::all_true(std::make_index_sequence<detail::LANE_SIZE>{}));
+    inline thread_local mask_t _current_mask(detail::Private{}, detail::all_true(std::make_index_sequence<detail::LANE_SIZE>{}));
 
     namespace detail
     {
@@ -208,10 +235,53 @@ namespace iic
             };
         }
 
+        // Types stored in lanes that can be converted to each other for every lane at once,
+        // without looking at the mask. Such conversions are done as a single pass over the
+        // whole array, which compilers turn into packed conversion instructions.
+        template<typename T>
+        struct is_lane_storage : std::is_arithmetic<T> {};
+
+        template<typename T, typename U>
+        concept lane_convertible = is_lane_storage<T>::value && is_lane_storage<U>::value;
+
+        // Converts every lane, specialized for types that have a dedicated vector path
+        template<typename T, typename U>
+        struct lane_converter
+        {
+            static std::array<T, LANE_SIZE> convert(const std::array<U, LANE_SIZE>& values)
+            {
+                auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+                {
+                    return std::array<T, LANE_SIZE>{
+                        static_cast<T>(values[I])...
+                    };
+                };
+                return helper(std::make_index_sequence<LANE_SIZE>{});
+            }
+        };
+
+        // Zeroes inactive lanes, so that garbage in them can't make a conversion misbehave
+        template<typename T, std::size_t... I>
+        std::array<T, LANE_SIZE> select_with_mask_impl(const std::array<T, LANE_SIZE>& values, std::index_sequence<I...>)
+        {
+            return {
+                (_current_mask._values[I] ? values[I] : T{})...
+            };
+        }
+
+        template<typename T>
+        std::array<T, LANE_SIZE> select_with_mask(const std::array<T, LANE_SIZE>& values)
+        {
+            return select_with_mask_impl(values, std::make_index_sequence<LANE_SIZE>{});
+        }
+
         template<typename T, typename U>
         std::array<T, LANE_SIZE> create_values_with_mask(const varying_impl<U>& other)
         {
-            return create_values_with_mask_impl<T>(other, std::make_index_sequence<LANE_SIZE>{});
+            if constexpr(lane_convertible<T, U>)
+                return lane_converter<T, U>::convert(select_with_mask(other._values));
+            else
+                return create_values_with_mask_impl<T>(other, std::make_index_sequence<LANE_SIZE>{});
         }
 
         template<typename T, typename U>
@@ -316,7 +386,11 @@ namespace iic
         requires std::convertible_to<U, T>
         varying_impl<T>& varying_impl<T>::operator=(const varying_impl<U>& other)
         {
-            write_in_place_with_mask(_values, other._values, std::make_index_sequence<LANE_SIZE>{});
+            if constexpr(lane_convertible<T, U> && !std::same_as<T, U>)
+                write_in_place_with_mask(_values, lane_converter<T, U>::convert(select_with_mask(other._values)),
+                                         std::make_index_sequence<LANE_SIZE>{});
+            else
+                write_in_place_with_mask(_values, other._values, std::make_index_sequence<LANE_SIZE>{});
             return *this;
         }
 
@@ -357,7 +431,7 @@ namespace iic
         template<typename U> \
         varying_impl<T>& varying_impl<T>::operator OP##=(const varying_impl<U>& other) \
         {\
-            auto helper = []<typename T2, typename U2, std::size_t... I>(std::array<T, LANE_SIZE>& self, const std::array<U, LANE_SIZE>& other, std::index_sequence<I...>) \
+            auto helper = []<std::size_t... I>(std::array<T, LANE_SIZE>& self, const std::array<U, LANE_SIZE>& other, std::index_sequence<I...>) \
             {\
                 ( \
                     [&]() \
@@ -368,6 +442,7 @@ namespace iic
                 );\
             };\
             helper(_values, other._values, std::make_index_sequence<LANE_SIZE>{});\
+            return *this;\
         }\
         template<typename T> \
         requires std::default_initializable<T> \
@@ -387,6 +462,22 @@ namespace iic
             };\
             helper(std::make_index_sequence<LANE_SIZE>{});                             \
             return *this;                             \
+        }\
+        template<typename T> \
+        requires std::default_initializable<T> \
+                 && std::copyable<T> \
+        template<typename U> \
+        varying_impl<T>& varying_impl<T>::operator OP##=(const varying_reference<U>& other) \
+        {\
+            return *this OP##= varying_impl<std::remove_cv_t<U>>(other);\
+        }\
+        template<typename T> \
+        requires std::default_initializable<T> \
+                 && std::copyable<T> \
+        template<typename U> \
+        varying_impl<T>& varying_impl<T>::operator OP##=(const varying_view<U>& other) \
+        {\
+            return *this OP##= varying_impl<std::remove_cv_t<U>>(other);\
         }
         FOR_ALL_ASSIGNABLE_OP(DEFINE_ASSIGN_OP)
 
@@ -489,16 +580,73 @@ namespace iic
             return out;
         }
 
+        enum class access_pattern
+        {
+            scattered,
+            // Every active lane points to the same place
+            same_address,
+            // Every lane is active and they point to consecutive elements
+            consecutive
+        };
+
+        // Accesses through varying pointers are often coherent (lookup tables,
+        // foreach over an array), checking for it is cheaper than doing one access per lane
+        // Works on pointers as well as offsets from a common base
+        template<typename P>
+        access_pattern classify_access(const std::array<P, LANE_SIZE>& pointers)
+        {
+            auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+            {
+                if(((_current_mask._values[I] && pointers[I] == pointers[0] + static_cast<std::ptrdiff_t>(I)) && ...))
+                    return access_pattern::consecutive;
+
+                const std::size_t first = std::find(_current_mask._values.begin(), _current_mask._values.end(), true)
+                                          - _current_mask._values.begin();
+                if(first == LANE_SIZE)
+                    return access_pattern::scattered;
+                if(((!_current_mask._values[I] || pointers[I] == pointers[first]) && ...))
+                    return access_pattern::same_address;
+                return access_pattern::scattered;
+            };
+            return helper(std::make_index_sequence<LANE_SIZE>{});
+        }
+
         template<typename T>
-        varying_reference<T>::operator varying_impl<std::remove_cv_t<T>>() const
+        template<typename U>
+        requires std::convertible_to<std::remove_cv_t<T>, U>
+        varying_reference<T>::operator varying_impl<U>() const
         {
+            using Value = std::remove_cv_t<T>;
             auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
             {
-                return std::array<std::remove_cv_t<T>, LANE_SIZE>{
-                    (_current_mask._values[I] ? *pointer._values[I]: std::remove_cv_t<T>{} )...
-                };
+                switch(classify_access(pointer._values))
+                {
+                    case access_pattern::consecutive:
+                    {
+                        std::array<Value, LANE_SIZE> values;
+                        std::copy_n(pointer._values[0], LANE_SIZE, values.begin());
+                        return values;
+                    }
+                    case access_pattern::same_address:
+                    {
+                        const std::size_t first = std::find(_current_mask._values.begin(), _current_mask._values.end(), true)
+                                                  - _current_mask._values.begin();
+                        const Value value = *pointer._values[first];
+                        return std::array<Value, LANE_SIZE>{
+                            (_current_mask._values[I] ? value : Value{})...
+                        };
+                    }
+                    default:
+                        return std::array<Value, LANE_SIZE>{
+                            (_current_mask._values[I] ? *pointer._values[I]: Value{} )...
+                        };
+                }
             };
-            return varying_impl<std::remove_cv_t<T>>(Private{}, helper(std::make_index_sequence<LANE_SIZE>{}));
+            varying_impl<Value> loaded(Private{}, helper(std::make_index_sequence<LANE_SIZE>{}));
+            if constexpr(std::same_as<std::remove_cv_t<T>, U>)
+                return loaded;
+            else
+                return varying_impl<U>(loaded);
         }
 
         template<typename T>
@@ -506,6 +654,13 @@ namespace iic
         requires std::convertible_to<U, T>
         varying_reference<T>& varying_reference<T>::operator=(const varying_impl<U>& other)
         {
+            if(classify_access(pointer._values) == access_pattern::consecutive)
+            {
+                const varying_impl<T> values(other);
+                std::copy_n(values._values.begin(), LANE_SIZE, pointer._values[0]);
+                return *this;
+            }
+
             auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
             {
                 (
@@ -589,7 +744,7 @@ namespace iic
                  && std::copyable<T> \
         varying_impl<T> varying_impl<T>::operator OP(int) \
         {\
-            auto helper = [&]<typename T2, typename U2, std::size_t... I>(std::index_sequence<I...>) \
+            auto helper = [&]<std::size_t... I>(std::index_sequence<I...>) \
             {\
                 return std::array<T, LANE_SIZE>{\
                     (_current_mask._values[I] ? _values[I] OP : T{})...\
@@ -601,7 +756,7 @@ namespace iic
         DEFINE_POST_INCREMENT(--)
         #undef DEFINE_POST_INCREMENT
         
-        varying_impl<std::size_t> computeProgramIndex()
+        constexpr varying_impl<std::size_t> computeProgramIndex()
         {
             auto helper = []<std::size_t... I>(std::index_sequence<I...>)
             {
@@ -614,8 +769,12 @@ namespace iic
         };
     }
     
-    const std::size_t programCount = detail::LANE_SIZE;
-    const varying<std::size_t> programIndex = detail::computeProgramIndex();
+    inline const std::size_t programCount = detail::LANE_SIZE;
+    inline const varying<std::size_t> programIndex = detail::computeProgramIndex();
 }
 
+#ifdef IIC_EXTERN_TEMPLATES
+#include "instantiations.hpp"
+#endif
+
 #endif // VARYING_HPP
\ No newline at end of file
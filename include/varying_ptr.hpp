@@ -0,0 +1,227 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef VARYING_PTR_HPP
+#define VARYING_PTR_HPP
+
+#include "varying.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    namespace detail
+    {
+        // Whether base[offset] can be done 4 lanes at a time with one hardware gather/scatter
+#if defined(__AVX2__)
+        template<typename T>
+        constexpr bool has_native_gather = std::is_trivially_copyable_v<T> && sizeof(T) == 4 && LANE_SIZE % 4 == 0;
+#else
+        template<typename T>
+        constexpr bool has_native_gather = false;
+#endif
+
+#if defined(__AVX512F__) && defined(__AVX512VL__)
+        template<typename T>
+        constexpr bool has_native_scatter = has_native_gather<T>;
+#else
+        template<typename T>
+        constexpr bool has_native_scatter = false;
+#endif
+
+#if defined(__AVX2__)
+        // Lanes [first, first + 4) of the current mask as a vector of 0/-1
+        inline __m128i mask_vector(std::size_t first)
+        {
+            std::int32_t bytes;
+            std::memcpy(&bytes, &_current_mask._values[first], 4);
+            return _mm_cmpgt_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)), _mm_setzero_si128());
+        }
+
+        template<typename T>
+        std::array<T, LANE_SIZE> native_gather(const T* base, const std::array<std::int32_t, LANE_SIZE>& offsets)
+        {
+            std::array<T, LANE_SIZE> result;
+            for(std::size_t i = 0; i < LANE_SIZE; i += 4)
+            {
+                const __m128i indices = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&offsets[i]));
+                const __m128i values = _mm_mask_i32gather_epi32(_mm_setzero_si128(), reinterpret_cast<const int*>(base),
+                                                                indices, mask_vector(i), 4);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&result[i]), values);
+            }
+            return result;
+        }
+#endif
+
+#if defined(__AVX512F__) && defined(__AVX512VL__)
+        template<typename T>
+        void native_scatter(T* base, const std::array<std::int32_t, LANE_SIZE>& offsets, const std::array<T, LANE_SIZE>& values)
+        {
+            for(std::size_t i = 0; i < LANE_SIZE; i += 4)
+            {
+                const __mmask8 mask = _mm_movemask_ps(_mm_castsi128_ps(mask_vector(i)));
+                _mm_mask_i32scatter_epi32(reinterpret_cast<int*>(base), mask,
+                                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(&offsets[i])),
+                                          _mm_loadu_si128(reinterpret_cast<const __m128i*>(&values[i])), 4);
+            }
+        }
+#endif
+
+        // Same as varying_reference, for a uniform base and 32 bits offsets
+        template<typename T>
+        struct offset_reference
+        {
+            T* base;
+            varying_impl<std::int32_t> offset;
+
+            template<typename U>
+            requires std::convertible_to<std::remove_cv_t<T>, U>
+            operator varying_impl<U>() const
+            {
+                using Value = std::remove_cv_t<T>;
+                auto helper = [&]<std::size_t... I>(std::index_sequence<I...>)
+                {
+                    switch(classify_access(offset._values))
+                    {
+                        case access_pattern::consecutive:
+                        {
+                            std::array<Value, LANE_SIZE> values;
+                            std::copy_n(base + offset._values[0], LANE_SIZE, values.begin());
+                            return values;
+                        }
+                        case access_pattern::same_address:
+                        {
+                            const std::size_t first = std::find(_current_mask._values.begin(), _current_mask._values.end(), true)
+                                                      - _current_mask._values.begin();
+                            const Value value = base[offset._values[first]];
+                            return std::array<Value, LANE_SIZE>{
+                                (_current_mask._values[I] ? value : Value{})...
+                            };
+                        }
+                        default:
+#if defined(__AVX2__)
+                            if constexpr(has_native_gather<Value>)
+                                return native_gather(base, offset._values);
+#endif
+                            return std::array<Value, LANE_SIZE>{
+                                (_current_mask._values[I] ? base[offset._values[I]] : Value{})...
+                            };
+                    }
+                };
+                varying_impl<Value> loaded(Private{}, helper(std::make_index_sequence<LANE_SIZE>{}));
+                if constexpr(std::same_as<Value, U>)
+                    return loaded;
+                else
+                    return varying_impl<U>(loaded);
+            }
+
+            template<typename U>
+            requires std::convertible_to<U, T>
+            offset_reference& operator=(const varying_impl<U>& other)
+            {
+                const varying_impl<T> values(other);
+                if(classify_access(offset._values) == access_pattern::consecutive)
+                {
+                    std::copy_n(values._values.begin(), LANE_SIZE, base + offset._values[0]);
+                    return *this;
+                }
+#if defined(__AVX512F__) && defined(__AVX512VL__)
+                if constexpr(has_native_scatter<T>)
+                {
+                    native_scatter(base, offset._values, values._values);
+                    return *this;
+                }
+#endif
+                for(std::size_t i = 0; i < LANE_SIZE; ++i)
+                    if(_current_mask._values[i])
+                        base[offset._values[i]] = values._values[i];
+                return *this;
+            }
+        };
+    }
+
+    // Varying pointer stored as a uniform base and a varying 32 bits offset (in elements)
+    // instead of a full pointer per lane. It takes half the registers of varying<T*>
+    // and its accesses map to the hardware gathers and scatters with 32 bits indices.
+    // All the lanes must stay within 2^31 elements of the base.
+    template<typename T>
+    struct varying_ptr
+    {
+        T* base;
+        detail::varying_impl<std::int32_t> offset;
+
+        varying_ptr(T* base):
+            base(base), offset(0)
+        {}
+
+        template<std::integral I>
+        varying_ptr(T* base, const detail::varying_impl<I>& offset):
+            base(base), offset(offset)
+        {}
+
+        template<std::integral I>
+        varying_ptr operator+(const detail::varying_impl<I>& index) const
+        {
+            return varying_ptr(base, offset + detail::varying_impl<std::int32_t>(index));
+        }
+
+        template<std::integral I>
+        varying_ptr operator+(I index) const
+        {
+            return varying_ptr(base, offset + static_cast<std::int32_t>(index));
+        }
+
+        detail::offset_reference<T> operator*() const
+        {
+            return { base, offset };
+        }
+
+        template<std::integral I>
+        detail::offset_reference<T> operator[](const detail::varying_impl<I>& index) const
+        {
+            return *(*this + index);
+        }
+
+        template<std::integral I>
+        detail::offset_reference<T> operator[](I index) const
+        {
+            return *(*this + index);
+        }
+
+        // Full pointer per lane, for the code that expects one
+        operator detail::varying_impl<T*>() const
+        {
+            return base + offset;
+        }
+    };
+
+    template<typename T, typename I>
+    varying_ptr(T*, const detail::varying_impl<I>&) -> varying_ptr<T>;
+}
+
+#endif // VARYING_PTR_HPP
@@ -0,0 +1,313 @@
+/*
+ * zlib License
+ *
+ * (C) 2021 Thomas FERRAND
+ * 
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ * 
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ * 
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef VARYING_VIEW_HPP
+#define VARYING_VIEW_HPP
+
+#include "varying.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+
+namespace iic::inline IIC_TARGET_NAMESPACE
+{
+    template<typename T>
+    struct varying_view;
+
+    namespace detail
+    {
+        inline bool all_lanes_active()
+        {
+            auto helper = []<std::size_t... I>(std::index_sequence<I...>)
+            {
+                return (_current_mask._values[I] && ...);
+            };
+            return helper(std::make_index_sequence<LANE_SIZE>{});
+        }
+
+        // Whether the active lanes hold consecutive values, as the indices of a foreach do
+        template<typename I>
+        bool active_lanes_consecutive(const std::array<I, LANE_SIZE>& index, std::size_t first)
+        {
+            for(std::size_t i = first; i < LANE_SIZE; ++i)
+                if(_current_mask._values[i] && index[i] != index[first] + static_cast<I>(i - first))
+                    return false;
+            return true;
+        }
+
+        template<typename T>
+        struct is_varying_view : std::false_type {};
+
+        template<typename T>
+        struct is_varying_view<varying_view<T>> : std::true_type {};
+
+        template<typename T>
+        struct is_varying_impl : std::false_type {};
+
+        template<typename T>
+        struct is_varying_impl<varying_impl<T>> : std::true_type {};
+
+        // What can be the other operand of a view without being a varying itself
+        template<typename T>
+        concept view_scalar_operand = !is_varying_view<T>::value && !is_varying_impl<T>::value;
+    }
+
+    // programCount consecutive elements of existing memory used as a varying, lane i being first[i].
+    // Reads and writes go straight to the memory, only the active lanes are accessed
+    // so the view can go past the end of an array in the lanes that are off.
+    // Assigning a view to a view copies the lanes, it doesn't rebind the view.
+    template<typename T>
+    struct varying_view
+    {
+        using Value = std::remove_cv_t<T>;
+
+        T* first;
+
+        explicit varying_view(T* first):
+            first(first)
+        {}
+
+        varying_view(const varying_view&) = default;
+
+        // The active lanes, the others are default initialized like in any computed varying
+        std::array<Value, detail::LANE_SIZE> load() const
+        {
+            std::array<Value, detail::LANE_SIZE> values;
+            if(detail::all_lanes_active())
+                std::copy_n(first, detail::LANE_SIZE, values.begin());
+            else
+                for(std::size_t i = 0; i < detail::LANE_SIZE; ++i)
+                    values[i] = _current_mask._values[i] ? first[i] : Value{};
+            return values;
+        }
+
+        template<typename U>
+        requires std::convertible_to<Value, U>
+        operator detail::varying_impl<U>() const
+        {
+            detail::varying_impl<Value> loaded(detail::Private{}, load());
+            if constexpr(std::same_as<Value, U>)
+                return loaded;
+            else
+                return detail::varying_impl<U>(loaded);
+        }
+
+        template<typename U>
+        requires std::convertible_to<U, T>
+        varying_view& operator=(const detail::varying_impl<U>& other)
+        {
+            const detail::varying_impl<T> values(other);
+            if(detail::all_lanes_active())
+                std::copy_n(values._values.begin(), detail::LANE_SIZE, first);
+            else
+                for(std::size_t i = 0; i < detail::LANE_SIZE; ++i)
+                    if(_current_mask._values[i])
+                        first[i] = values._values[i];
+            return *this;
+        }
+
+        template<typename U>
+        requires std::convertible_to<U, T> && detail::view_scalar_operand<U>
+        varying_view& operator=(const U& other)
+        {
+            const T value = other;
+            if(detail::all_lanes_active())
+                std::fill_n(first, detail::LANE_SIZE, value);
+            else
+                for(std::size_t i = 0; i < detail::LANE_SIZE; ++i)
+                    if(_current_mask._values[i])
+                        first[i] = value;
+            return *this;
+        }
+
+        varying_view& operator=(const varying_view& other)
+        {
+            return *this = detail::varying_impl<Value>(other);
+        }
+
+        template<typename U>
+        varying_view& operator=(const varying_view<U>& other)
+        {
+            return *this = detail::varying_impl<std::remove_cv_t<U>>(other);
+        }
+
+        // In place update of the memory, without going through a temporary varying
+        #define IIC_DECLARE_VIEW_ASSIGN_OP(OP) \
+        template<typename U> \
+        varying_view& operator OP##=(const detail::varying_impl<U>& other) \
+        { \
+            update([&](std::size_t i) -> const U& { return other._values[i]; }, [](T& self, const U& value) { self OP##= value; }); \
+            return *this; \
+        } \
+        template<typename U> \
+        varying_view& operator OP##=(const varying_view<U>& other) \
+        { \
+            return *this OP##= detail::varying_impl<std::remove_cv_t<U>>(other); \
+        } \
+        template<detail::view_scalar_operand U> \
+        varying_view& operator OP##=(const U& other) \
+        { \
+            update([&](std::size_t) -> const U& { return other; }, [](T& self, const U& value) { self OP##= value; }); \
+            return *this; \
+        }
+        IIC_DECLARE_VIEW_ASSIGN_OP(+)
+        IIC_DECLARE_VIEW_ASSIGN_OP(-)
+        IIC_DECLARE_VIEW_ASSIGN_OP(*)
+        IIC_DECLARE_VIEW_ASSIGN_OP(/)
+        IIC_DECLARE_VIEW_ASSIGN_OP(%)
+        IIC_DECLARE_VIEW_ASSIGN_OP(&)
+        IIC_DECLARE_VIEW_ASSIGN_OP(|)
+        IIC_DECLARE_VIEW_ASSIGN_OP(^)
+        IIC_DECLARE_VIEW_ASSIGN_OP(<<)
+        IIC_DECLARE_VIEW_ASSIGN_OP(>>)
+        #undef IIC_DECLARE_VIEW_ASSIGN_OP
+
+    private:
+        // apply(first[i], operand(i)) on every active lane, with a loop the compiler can vectorize
+        // when they all are
+        template<typename Operand, typename Apply>
+        void update(Operand&& operand, Apply&& apply)
+        {
+            if(detail::all_lanes_active())
+            {
+                for(std::size_t i = 0; i < detail::LANE_SIZE; ++i)
+                    apply(first[i], operand(i));
+            }
+            else
+            {
+                for(std::size_t i = 0; i < detail::LANE_SIZE; ++i)
+                    if(_current_mask._values[i])
+                        apply(first[i], operand(i));
+            }
+        }
+    };
+
+    template<typename T>
+    varying_view(T*) -> varying_view<T>;
+
+    // Binary operators load the views and use the varying ones
+    #define IIC_DEFINE_VIEW_OP(OP) \
+    template<typename LHS, typename RHS> \
+    auto operator OP(const varying_view<LHS>& lhs, const varying_view<RHS>& rhs) \
+    { \
+        return detail::varying_impl<std::remove_cv_t<LHS>>(lhs) OP detail::varying_impl<std::remove_cv_t<RHS>>(rhs); \
+    } \
+    template<typename LHS, typename RHS> \
+    auto operator OP(const varying_view<LHS>& lhs, const detail::varying_impl<RHS>& rhs) \
+    { \
+        return detail::varying_impl<std::remove_cv_t<LHS>>(lhs) OP rhs; \
+    } \
+    template<typename LHS, typename RHS> \
+    auto operator OP(const detail::varying_impl<LHS>& lhs, const varying_view<RHS>& rhs) \
+    { \
+        return lhs OP detail::varying_impl<std::remove_cv_t<RHS>>(rhs); \
+    } \
+    template<typename LHS, detail::view_scalar_operand RHS> \
+    auto operator OP(const varying_view<LHS>& lhs, const RHS& rhs) \
+        -> decltype(detail::varying_impl<std::remove_cv_t<LHS>>(lhs) OP rhs) \
+    { \
+        return detail::varying_impl<std::remove_cv_t<LHS>>(lhs) OP rhs; \
+    } \
+    template<detail::view_scalar_operand LHS, typename RHS> \
+    auto operator OP(const LHS& lhs, const varying_view<RHS>& rhs) \
+        -> decltype(lhs OP detail::varying_impl<std::remove_cv_t<RHS>>(rhs)) \
+    { \
+        return lhs OP detail::varying_impl<std::remove_cv_t<RHS>>(rhs); \
+    }
+    IIC_DEFINE_VIEW_OP(+)
+    IIC_DEFINE_VIEW_OP(-)
+    IIC_DEFINE_VIEW_OP(*)
+    IIC_DEFINE_VIEW_OP(/)
+    IIC_DEFINE_VIEW_OP(%)
+    IIC_DEFINE_VIEW_OP(&)
+    IIC_DEFINE_VIEW_OP(|)
+    IIC_DEFINE_VIEW_OP(^)
+    IIC_DEFINE_VIEW_OP(<<)
+    IIC_DEFINE_VIEW_OP(>>)
+    IIC_DEFINE_VIEW_OP(&&)
+    IIC_DEFINE_VIEW_OP(||)
+    IIC_DEFINE_VIEW_OP(==)
+    IIC_DEFINE_VIEW_OP(!=)
+    IIC_DEFINE_VIEW_OP(<)
+    IIC_DEFINE_VIEW_OP(>)
+    IIC_DEFINE_VIEW_OP(<=)
+    IIC_DEFINE_VIEW_OP(>=)
+    #undef IIC_DEFINE_VIEW_OP
+
+    #define IIC_DEFINE_VIEW_UNARY_OP(OP) \
+    template<typename T> \
+    auto operator OP(const varying_view<T>& self) \
+    { \
+        return OP detail::varying_impl<std::remove_cv_t<T>>(self); \
+    }
+    IIC_DEFINE_VIEW_UNARY_OP(+)
+    IIC_DEFINE_VIEW_UNARY_OP(-)
+    IIC_DEFINE_VIEW_UNARY_OP(!)
+    IIC_DEFINE_VIEW_UNARY_OP(~)
+    #undef IIC_DEFINE_VIEW_UNARY_OP
+
+    // Array indexed by foreach indices: data[i] is a view on the elements of the lanes of i
+    // instead of a gather, so
+    //     iic::varying_span data(values);
+    //     iic_foreach(i : iic::range(0, n))
+    //         data[i] *= k;
+    // updates the array in place. The active lanes of the index must be consecutive, and the lanes
+    // before the first active one must not fall before the start of the array.
+    template<typename T>
+    struct varying_span
+    {
+        std::span<T> elements;
+
+        varying_span(std::span<T> elements):
+            elements(elements)
+        {}
+
+        template<std::integral I>
+        varying_view<T> operator[](const detail::varying_impl<I>& index) const
+        {
+            // Lanes past the end of a foreach are off and hold 0, the first active lane gives the start
+            const std::size_t lane = std::find(_current_mask._values.begin(), _current_mask._values.end(), true)
+                                     - _current_mask._values.begin();
+            if(lane == detail::LANE_SIZE)
+                return varying_view<T>(elements.data());
+            assert(detail::active_lanes_consecutive(index._values, lane));
+            // Offset of lane 0 computed on integers, it must still be in the array
+            const std::ptrdiff_t start = static_cast<std::ptrdiff_t>(index._values[lane]) - static_cast<std::ptrdiff_t>(lane);
+            assert(start >= 0 && start <= std::ssize(elements));
+            return varying_view<T>(elements.data() + start);
+        }
+
+        T& operator[](std::size_t index) const
+        {
+            return elements[index];
+        }
+    };
+
+    template<typename R>
+    varying_span(R&) -> varying_span<std::remove_reference_t<decltype(*std::span(std::declval<R&>()).data())>>;
+}
+
+#endif // VARYING_VIEW_HPP
@@ -0,0 +1,25 @@
+#include "include/dispatch.hpp"
+#include "include/control_flow.hpp"
+#include "include/float16.hpp"
+
+
+// Compiled once per target, see iic_add_kernels in CMakeLists.txt
+IIC_KERNEL(void, sum, (const float* a, const float* b, float* c, int n))
+{
+    iic_foreach(i : iic::range(0, n))
+    {
+        iic::varying<float> x = *(a + i);
+        iic::varying<float> y = *(b + i);
+        *(c + i) = x + y;
+    }
+}
+
+// Storage types of the library are the same for every target, so they can be in a kernel signature
+IIC_KERNEL(void, widen, (const iic::float16_t* half, float* result, int n))
+{
+    iic_foreach(i : iic::range(0, n))
+    {
+        iic::varying<float> x = *(half + i);
+        *(result + i) = x;
+    }
+}
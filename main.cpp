@@ -1,10 +1,19 @@
+#include <cstdint>
 #include <iostream>
 #include "include/varying.hpp"
 #include "include/control_flow.hpp"
+#include "include/dispatch.hpp"
+#include "include/float16.hpp"
+#include "include/sort.hpp"
+#include "include/algorithm.hpp"
 
 
 using iic::varying;
 
+IIC_DISPATCH_KERNEL(void, sum, (const float*, const float*, float*, int));
+IIC_DISPATCH_KERNEL(void, brighten, (const std::uint8_t*, std::uint8_t*, std::uint8_t, int));
+IIC_DISPATCH_KERNEL(void, widen, (const iic::float16_t*, float*, int));
+
 varying<float> max(varying<float> a, const varying<float>& b)
 {
     iic_if(b > a)
@@ -61,6 +70,10 @@ int main()
         std::cout << lane << " ";
     std::cout << std::endl;
     
+    iic_foreach_unique(value : a)
+        std::cout << value << " ";
+    std::cout << std::endl;
+    
     auto c = a * 2 - 3;
 
     iic_unmasked
@@ -91,6 +104,44 @@ int main()
     
     thingy(0, 30);
     
+    float sums[8];
+    sum(arr, arr, sums, 8);
+    std::cout << iic::target_name(sum.selected_target()) << ": ";
+    for(float s : sums)
+        std::cout << s << " ";
+    std::cout << std::endl;
+    
+    iic::float16_t halves[8];
+    float widened[8];
+    for(int i = 0; i < 8; ++i)
+        halves[i] = i * 0.5f;
+    widen(halves, widened, 8);
+    std::cout << iic::target_name(widen.selected_target()) << " (" << widen.available.size() << " versions): ";
+    for(float w : widened)
+        std::cout << w << " ";
+    std::cout << std::endl;
+    
+    std::uint8_t pixels[40], brightened[40];
+    for(int i = 0; i < 40; ++i)
+        pixels[i] = static_cast<std::uint8_t>(i * 7);
+    brighten(pixels, brightened, 40, 40);
+    std::cout << iic::target_name(brighten.selected_target()) << ": ";
+    for(std::uint8_t p : brightened)
+        std::cout << int(p) << " ";
+    std::cout << std::endl;
+    
+    int unsorted[] = { 5, 3, 9, 1, 7, 2, 8, 6, 4, 0, 11, 10 };
+    iic::sort(unsorted, 12);
+    for(int value : unsorted)
+        std::cout << value << " ";
+    std::cout << std::endl;
+    
+    float squares[12];
+    iic::transform(unsorted, squares, [](varying<int> value) { return varying<float>(value * value); });
+    for(float square : squares)
+        std::cout << square << " ";
+    std::cout << std::endl;
+    
     
     return 0;
 }
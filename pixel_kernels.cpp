@@ -0,0 +1,16 @@
+#include "include/dispatch.hpp"
+#include "include/control_flow.hpp"
+#include "include/saturating.hpp"
+
+#include <cstdint>
+
+
+// Compiled with one lane per byte of a vector register, see iic_add_kernels in CMakeLists.txt
+IIC_KERNEL(void, brighten, (const std::uint8_t* pixels, std::uint8_t* result, std::uint8_t amount, int n))
+{
+    iic_foreach(i : iic::range(0, n))
+    {
+        iic::varying<std::uint8_t> pixel = *(pixels + i);
+        *(result + i) = iic::add_sat(pixel, iic::varying<std::uint8_t>(amount));
+    }
+}
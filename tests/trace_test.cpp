@@ -0,0 +1,38 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "algorithm.hpp"
+#include "trace.hpp"
+
+
+// Threads started by every parallel transform give their trace buffer back when they end,
+// so the number of buffers stays the number of threads running at once
+int main()
+{
+    constexpr unsigned threads = 4;
+    constexpr int calls = 200;
+    std::vector<float> input(threads * 32 * 1024, 1.f), output(input.size());
+    for(int call = 0; call < calls; ++call)
+        iic::transform(iic::parallel_policy{ threads }, input, output, [](iic::varying<float> x) { return x * 2.f; });
+
+    const unsigned buffers = iic::trace::buffer_count();
+    if(buffers > threads)
+    {
+        std::cerr << calls << " parallel transforms on " << threads << " threads used " << buffers << " trace buffers" << std::endl;
+        return 1;
+    }
+
+    std::ostringstream trace;
+    iic::trace::write_chrome_json(trace);
+    if(trace.str().find("\"piece\"") == std::string::npos)
+    {
+        std::cerr << "the pieces of the transforms are missing from the trace" << std::endl;
+        return 1;
+    }
+    if(output.front() != 2.f || output.back() != 2.f)
+    {
+        std::cerr << "wrong result" << std::endl;
+        return 1;
+    }
+}